@@ -14,6 +14,28 @@ function(example_add_define define)
 
 endfunction()
 
+# Adds source files that are outside of the folder of the example, like the
+# code of a library that is shared with other examples. The folder of each file
+# is added to the include paths as well.
+function(example_add_sources)
+
+    get_filename_component(EXECUTABLE_NAME ${CMAKE_CURRENT_SOURCE_DIR} NAME)
+
+    foreach(FILE ${ARGN})
+        get_filename_component(FILE_PATH ${FILE} ABSOLUTE)
+        get_filename_component(FILE_DIR ${FILE_PATH} DIRECTORY)
+
+        target_sources(${EXECUTABLE_NAME} PRIVATE ${FILE_PATH})
+        target_include_directories(${EXECUTABLE_NAME} PRIVATE ${FILE_DIR})
+        if(BUILD_GBA_INTERNAL)
+            set(GBA_ELF_NAME ${EXECUTABLE_NAME}_gba.elf)
+            target_sources(${GBA_ELF_NAME} PRIVATE ${FILE_PATH})
+            target_include_directories(${GBA_ELF_NAME} PRIVATE ${FILE_DIR})
+        endif()
+    endforeach()
+
+endfunction()
+
 function(enable_debug_example)
 
     example_add_define(UGBA_DEBUG)
@@ -153,6 +175,31 @@ macro(example_build_sdl2)
 
 endmacro()
 
+# Each variant of a test runs in its own folder. All of them write files with
+# the same names (screenshot.png, audio.wav, SRAM saves...), so they can't share
+# a folder if tests are run in parallel with `ctest -j`.
+function(unittest_working_dir variant var)
+
+    set(WORKING_DIR "${CMAKE_CURRENT_BINARY_DIR}/test-${variant}")
+    file(MAKE_DIRECTORY ${WORKING_DIR})
+    set(${var} ${WORKING_DIR} PARENT_SCOPE)
+
+endfunction()
+
+# If UGBA_TEST_CACHE is enabled, this generates the arguments needed by
+# runcommands.cmake to skip a test that has already passed. The arguments of
+# the function are all the files that the result of the test depends on.
+function(unittest_cache_args var)
+
+    if(UGBA_TEST_CACHE)
+        string(REPLACE ";" "|" CACHE_FILES "${ARGN}")
+        set(${var} "-DCACHE_FILES=${CACHE_FILES}" PARENT_SCOPE)
+    else()
+        set(${var} "" PARENT_SCOPE)
+    endif()
+
+endfunction()
+
 # TODO: There must be some way to make a generic function for any number of
 # screenshots.
 
@@ -181,12 +228,22 @@ function(unittest_screenshot)
     set(CMD1 "$<TARGET_FILE:${EXECUTABLE_NAME}> --lua ${TEST_SCRIPT}")
     set(CMD2 "$<TARGET_FILE:pngmatch> ${REF_PNG} screenshot.png")
 
+    unittest_working_dir(sdl2 WORKING_DIR)
+    unittest_cache_args(CACHE_ARGS
+        $<TARGET_FILE:${EXECUTABLE_NAME}>
+        $<TARGET_FILE:libugba>
+        $<TARGET_FILE:pngmatch>
+        ${TEST_SCRIPT}
+        ${REF_PNG}
+    )
+
     add_test(NAME ${EXECUTABLE_NAME}_test
         COMMAND ${CMAKE_COMMAND}
                     -DCMD1=${CMD1}
                     -DCMD2=${CMD2}
+                    ${CACHE_ARGS}
                     -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        WORKING_DIRECTORY ${WORKING_DIR}
     )
     set_tests_properties(${EXECUTABLE_NAME}_test
         PROPERTIES LABELS "${GROUP_NAME}"
@@ -211,12 +268,22 @@ function(unittest_screenshot)
         set(CMD1 "$<TARGET_FILE:giibiiadvance> --lua ${TEST_SCRIPT} ${GBA_ROM}")
         set(CMD2 "$<TARGET_FILE:pngmatch> ${REF_PNG} screenshot.png")
 
+        unittest_working_dir(gba WORKING_DIR)
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:giibiiadvance>
+            $<TARGET_FILE:pngmatch>
+            ${TEST_SCRIPT}
+            ${GBA_ROM}
+            ${REF_PNG}
+        )
+
         add_test(NAME ${EXECUTABLE_NAME}_gba_test
             COMMAND ${CMAKE_COMMAND}
                         -DCMD1=${CMD1}
                         -DCMD2=${CMD2}
+                        ${CACHE_ARGS}
                         -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+            WORKING_DIRECTORY ${WORKING_DIR}
         )
         set_tests_properties(${EXECUTABLE_NAME}_gba_test
             PROPERTIES LABELS "${GROUP_NAME};gba"
@@ -251,13 +318,24 @@ function(unittest_two_screenshots)
     set(CMD2 "$<TARGET_FILE:pngmatch> ${REF_1_PNG} screenshot-1.png")
     set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_2_PNG} screenshot-2.png")
 
+    unittest_working_dir(sdl2 WORKING_DIR)
+    unittest_cache_args(CACHE_ARGS
+        $<TARGET_FILE:${EXECUTABLE_NAME}>
+        $<TARGET_FILE:libugba>
+        $<TARGET_FILE:pngmatch>
+        ${TEST_SCRIPT}
+        ${REF_1_PNG}
+        ${REF_2_PNG}
+    )
+
     add_test(NAME ${EXECUTABLE_NAME}_test
         COMMAND ${CMAKE_COMMAND}
                     -DCMD1=${CMD1}
                     -DCMD2=${CMD2}
                     -DCMD3=${CMD3}
+                    ${CACHE_ARGS}
                     -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        WORKING_DIRECTORY ${WORKING_DIR}
     )
     set_tests_properties(${EXECUTABLE_NAME}_test
         PROPERTIES LABELS "${GROUP_NAME}"
@@ -288,13 +366,24 @@ function(unittest_two_screenshots)
         set(CMD2 "$<TARGET_FILE:pngmatch> ${REF_1_PNG} screenshot-1.png")
         set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_2_PNG} screenshot-2.png")
 
+        unittest_working_dir(gba WORKING_DIR)
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:giibiiadvance>
+            $<TARGET_FILE:pngmatch>
+            ${TEST_SCRIPT}
+            ${GBA_ROM}
+            ${REF_1_PNG}
+            ${REF_2_PNG}
+        )
+
         add_test(NAME ${EXECUTABLE_NAME}_gba_test
             COMMAND ${CMAKE_COMMAND}
                         -DCMD1=${CMD1}
                         -DCMD2=${CMD2}
                         -DCMD3=${CMD3}
+                        ${CACHE_ARGS}
                         -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+            WORKING_DIRECTORY ${WORKING_DIR}
         )
         set_tests_properties(${EXECUTABLE_NAME}_gba_test
             PROPERTIES LABELS "${GROUP_NAME};gba"
@@ -335,14 +424,26 @@ function(unittest_three_screenshots)
     set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_2_PNG} screenshot-2.png")
     set(CMD4 "$<TARGET_FILE:pngmatch> ${REF_3_PNG} screenshot-3.png")
 
+    unittest_working_dir(sdl2 WORKING_DIR)
+    unittest_cache_args(CACHE_ARGS
+        $<TARGET_FILE:${EXECUTABLE_NAME}>
+        $<TARGET_FILE:libugba>
+        $<TARGET_FILE:pngmatch>
+        ${TEST_SCRIPT}
+        ${REF_1_PNG}
+        ${REF_2_PNG}
+        ${REF_3_PNG}
+    )
+
     add_test(NAME ${EXECUTABLE_NAME}_test
         COMMAND ${CMAKE_COMMAND}
                     -DCMD1=${CMD1}
                     -DCMD2=${CMD2}
                     -DCMD3=${CMD3}
                     -DCMD4=${CMD4}
+                    ${CACHE_ARGS}
                     -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        WORKING_DIRECTORY ${WORKING_DIR}
     )
     set_tests_properties(${EXECUTABLE_NAME}_test
         PROPERTIES LABELS "${GROUP_NAME}"
@@ -379,14 +480,26 @@ function(unittest_three_screenshots)
         set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_2_PNG} screenshot-2.png")
         set(CMD4 "$<TARGET_FILE:pngmatch> ${REF_3_PNG} screenshot-3.png")
 
+        unittest_working_dir(gba WORKING_DIR)
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:giibiiadvance>
+            $<TARGET_FILE:pngmatch>
+            ${TEST_SCRIPT}
+            ${GBA_ROM}
+            ${REF_1_PNG}
+            ${REF_2_PNG}
+            ${REF_3_PNG}
+        )
+
         add_test(NAME ${EXECUTABLE_NAME}_gba_test
             COMMAND ${CMAKE_COMMAND}
                         -DCMD1=${CMD1}
                         -DCMD2=${CMD2}
                         -DCMD3=${CMD3}
                         -DCMD4=${CMD4}
+                        ${CACHE_ARGS}
                         -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+            WORKING_DIRECTORY ${WORKING_DIR}
         )
         set_tests_properties(${EXECUTABLE_NAME}_gba_test
             PROPERTIES LABELS "${GROUP_NAME};gba"
@@ -418,14 +531,24 @@ function(unittest_audio)
     endif()
 
     set(CMD1 "$<TARGET_FILE:${EXECUTABLE_NAME}> --lua ${TEST_SCRIPT}")
-    set(CMD2 "${CMAKE_COMMAND} -E compare_files ${REF_WAV} audio.wav")
+    set(CMD2 "$<TARGET_FILE:wavmatch> ${REF_WAV} audio.wav")
+
+    unittest_working_dir(sdl2 WORKING_DIR)
+    unittest_cache_args(CACHE_ARGS
+        $<TARGET_FILE:${EXECUTABLE_NAME}>
+        $<TARGET_FILE:libugba>
+        $<TARGET_FILE:wavmatch>
+        ${TEST_SCRIPT}
+        ${REF_WAV}
+    )
 
     add_test(NAME ${EXECUTABLE_NAME}_test
         COMMAND ${CMAKE_COMMAND}
                     -DCMD1=${CMD1}
                     -DCMD2=${CMD2}
+                    ${CACHE_ARGS}
                     -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        WORKING_DIRECTORY ${WORKING_DIR}
     )
     set_tests_properties(${EXECUTABLE_NAME}_test
         PROPERTIES LABELS "${GROUP_NAME}"
@@ -449,14 +572,132 @@ function(unittest_audio)
         set(GBA_ROM "${CMAKE_CURRENT_BINARY_DIR}/gba/${EXECUTABLE_NAME}_gba.gba")
 
         set(CMD1 "$<TARGET_FILE:giibiiadvance> --lua ${TEST_SCRIPT} ${GBA_ROM}")
-        set(CMD2 "${CMAKE_COMMAND} -E compare_files ${REF_WAV} audio.wav")
+        set(CMD2 "$<TARGET_FILE:wavmatch> ${REF_WAV} audio.wav")
+
+        unittest_working_dir(gba WORKING_DIR)
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:giibiiadvance>
+            $<TARGET_FILE:wavmatch>
+            ${TEST_SCRIPT}
+            ${GBA_ROM}
+            ${REF_WAV}
+        )
+
+        add_test(NAME ${EXECUTABLE_NAME}_gba_test
+            COMMAND ${CMAKE_COMMAND}
+                        -DCMD1=${CMD1}
+                        -DCMD2=${CMD2}
+                        ${CACHE_ARGS}
+                        -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
+            WORKING_DIRECTORY ${WORKING_DIR}
+        )
+        set_tests_properties(${EXECUTABLE_NAME}_gba_test
+            PROPERTIES LABELS "${GROUP_NAME};gba"
+        )
+    endif()
+
+endfunction()
+
+# Audio test for examples that must sound exactly like a different example. The
+# reference isn't stored in the repository: it's recorded by the other example
+# with its own test script, and then compared with the audio of this example.
+function(unittest_audio_same_as reference_example)
+
+    # Get name of the folder we are in
+    # --------------------------------
+
+    get_filename_component(EXECUTABLE_NAME ${CMAKE_CURRENT_SOURCE_DIR} NAME)
+    get_filename_component(PARENT_PATH "${CMAKE_CURRENT_SOURCE_DIR}/.." ABSOLUTE)
+    get_filename_component(GROUP_NAME "${PARENT_PATH}" NAME)
+
+    set(REF_SOURCE_DIR "${PARENT_PATH}/${reference_example}")
+
+    # SDL2 test
+    # ---------
+
+    set(TEST_SCRIPT "${CMAKE_CURRENT_SOURCE_DIR}/test-sdl2.lua")
+    if(NOT EXISTS ${TEST_SCRIPT})
+        set(TEST_SCRIPT "${CMAKE_CURRENT_SOURCE_DIR}/test.lua")
+    endif()
+
+    set(REF_SCRIPT "${REF_SOURCE_DIR}/test-sdl2.lua")
+    if(NOT EXISTS ${REF_SCRIPT})
+        set(REF_SCRIPT "${REF_SOURCE_DIR}/test.lua")
+    endif()
+
+    # Both examples save their audio as "audio.wav", so the reference example
+    # is run in a different folder.
+    unittest_working_dir(sdl2 WORKING_DIR)
+    unittest_working_dir(sdl2-reference REF_WORKING_DIR)
+
+    set(CMD1 "${CMAKE_COMMAND} -E chdir ${REF_WORKING_DIR} $<TARGET_FILE:${reference_example}> --lua ${REF_SCRIPT}")
+    set(CMD2 "$<TARGET_FILE:${EXECUTABLE_NAME}> --lua ${TEST_SCRIPT}")
+    set(CMD3 "$<TARGET_FILE:wavmatch> ${REF_WORKING_DIR}/audio.wav audio.wav")
+
+    unittest_cache_args(CACHE_ARGS
+        $<TARGET_FILE:${reference_example}>
+        $<TARGET_FILE:${EXECUTABLE_NAME}>
+        $<TARGET_FILE:libugba>
+        $<TARGET_FILE:wavmatch>
+        ${REF_SCRIPT}
+        ${TEST_SCRIPT}
+    )
+
+    add_test(NAME ${EXECUTABLE_NAME}_test
+        COMMAND ${CMAKE_COMMAND}
+                    -DCMD1=${CMD1}
+                    -DCMD2=${CMD2}
+                    -DCMD3=${CMD3}
+                    ${CACHE_ARGS}
+                    -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
+        WORKING_DIRECTORY ${WORKING_DIR}
+    )
+    set_tests_properties(${EXECUTABLE_NAME}_test
+        PROPERTIES LABELS "${GROUP_NAME}"
+    )
+
+    # Emulator test
+    # -------------
+
+    # TODO: GBA audio tests are broken
+    if(FALSE) # if(BUILD_GBA_INTERNAL)
+        set(TEST_SCRIPT "${CMAKE_CURRENT_SOURCE_DIR}/test-gba.lua")
+        if(NOT EXISTS ${TEST_SCRIPT})
+            set(TEST_SCRIPT "${CMAKE_CURRENT_SOURCE_DIR}/test.lua")
+        endif()
+
+        set(REF_SCRIPT "${REF_SOURCE_DIR}/test-gba.lua")
+        if(NOT EXISTS ${REF_SCRIPT})
+            set(REF_SCRIPT "${REF_SOURCE_DIR}/test.lua")
+        endif()
+
+        set(GBA_ROM "${CMAKE_CURRENT_BINARY_DIR}/gba/${EXECUTABLE_NAME}_gba.gba")
+        set(REF_GBA_ROM "${CMAKE_CURRENT_BINARY_DIR}/../${reference_example}/gba/${reference_example}_gba.gba")
+
+        unittest_working_dir(gba WORKING_DIR)
+        unittest_working_dir(gba-reference REF_WORKING_DIR)
+
+        set(CMD1 "${CMAKE_COMMAND} -E chdir ${REF_WORKING_DIR} $<TARGET_FILE:giibiiadvance> --lua ${REF_SCRIPT} ${REF_GBA_ROM}")
+        set(CMD2 "$<TARGET_FILE:giibiiadvance> --lua ${TEST_SCRIPT} ${GBA_ROM}")
+        set(CMD3 "$<TARGET_FILE:wavmatch> ${REF_WORKING_DIR}/audio.wav audio.wav")
+
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:giibiiadvance>
+            $<TARGET_FILE:wavmatch>
+            ${REF_SCRIPT}
+            ${TEST_SCRIPT}
+            ${REF_GBA_ROM}
+            ${GBA_ROM}
+        )
 
         add_test(NAME ${EXECUTABLE_NAME}_gba_test
             COMMAND ${CMAKE_COMMAND}
                         -DCMD1=${CMD1}
                         -DCMD2=${CMD2}
+                        -DCMD3=${CMD3}
+                        ${CACHE_ARGS}
                         -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+            WORKING_DIRECTORY ${WORKING_DIR}
         )
         set_tests_properties(${EXECUTABLE_NAME}_gba_test
             PROPERTIES LABELS "${GROUP_NAME};gba"
@@ -493,16 +734,28 @@ function(unittest_audio_screenshot)
     endif()
 
     set(CMD1 "$<TARGET_FILE:${EXECUTABLE_NAME}> --lua ${TEST_SCRIPT}")
-    set(CMD2 "${CMAKE_COMMAND} -E compare_files ${REF_WAV} audio.wav")
+    set(CMD2 "$<TARGET_FILE:wavmatch> ${REF_WAV} audio.wav")
     set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_PNG} screenshot.png")
 
+    unittest_working_dir(sdl2 WORKING_DIR)
+    unittest_cache_args(CACHE_ARGS
+        $<TARGET_FILE:${EXECUTABLE_NAME}>
+        $<TARGET_FILE:libugba>
+        $<TARGET_FILE:wavmatch>
+        $<TARGET_FILE:pngmatch>
+        ${TEST_SCRIPT}
+        ${REF_WAV}
+        ${REF_PNG}
+    )
+
     add_test(NAME ${EXECUTABLE_NAME}_test
         COMMAND ${CMAKE_COMMAND}
                     -DCMD1=${CMD1}
                     -DCMD2=${CMD2}
                     -DCMD3=${CMD3}
+                    ${CACHE_ARGS}
                     -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        WORKING_DIRECTORY ${WORKING_DIR}
     )
     set_tests_properties(${EXECUTABLE_NAME}_test
         PROPERTIES LABELS "${GROUP_NAME}"
@@ -531,16 +784,28 @@ function(unittest_audio_screenshot)
         set(GBA_ROM "${CMAKE_CURRENT_BINARY_DIR}/gba/${EXECUTABLE_NAME}_gba.gba")
 
         set(CMD1 "$<TARGET_FILE:giibiiadvance> --lua ${TEST_SCRIPT} ${GBA_ROM}")
-        set(CMD2 "${CMAKE_COMMAND} -E compare_files ${REF_WAV} audio.wav")
+        set(CMD2 "$<TARGET_FILE:wavmatch> ${REF_WAV} audio.wav")
         set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_PNG} screenshot.png")
 
+        unittest_working_dir(gba WORKING_DIR)
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:giibiiadvance>
+            $<TARGET_FILE:wavmatch>
+            $<TARGET_FILE:pngmatch>
+            ${TEST_SCRIPT}
+            ${GBA_ROM}
+            ${REF_WAV}
+            ${REF_PNG}
+        )
+
         add_test(NAME ${EXECUTABLE_NAME}_gba_test
             COMMAND ${CMAKE_COMMAND}
                         -DCMD1=${CMD1}
                         -DCMD2=${CMD2}
                         -DCMD3=${CMD3}
+                        ${CACHE_ARGS}
                         -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+            WORKING_DIRECTORY ${WORKING_DIR}
         )
         set_tests_properties(${EXECUTABLE_NAME}_gba_test
             PROPERTIES LABELS "${GROUP_NAME};gba"
@@ -569,13 +834,24 @@ function(unittest_sram)
     set(CMD2 "$<TARGET_FILE:${EXECUTABLE_NAME}> --lua ${TEST_SCRIPT_2}")
     set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_PNG} screenshot.png")
 
+    unittest_working_dir(sdl2 WORKING_DIR)
+    unittest_cache_args(CACHE_ARGS
+        $<TARGET_FILE:${EXECUTABLE_NAME}>
+        $<TARGET_FILE:libugba>
+        $<TARGET_FILE:pngmatch>
+        ${TEST_SCRIPT_1}
+        ${TEST_SCRIPT_2}
+        ${REF_PNG}
+    )
+
     add_test(NAME ${EXECUTABLE_NAME}_test
         COMMAND ${CMAKE_COMMAND}
                     -DCMD1=${CMD1}
                     -DCMD2=${CMD2}
                     -DCMD3=${CMD3}
+                    ${CACHE_ARGS}
                     -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        WORKING_DIRECTORY ${WORKING_DIR}
     )
     set_tests_properties(${EXECUTABLE_NAME}_test
         PROPERTIES LABELS "${GROUP_NAME}"
@@ -591,13 +867,24 @@ function(unittest_sram)
         set(CMD2 "$<TARGET_FILE:giibiiadvance> --lua ${TEST_SCRIPT_2} ${GBA_ROM}")
         set(CMD3 "$<TARGET_FILE:pngmatch> ${REF_PNG} screenshot.png")
 
+        unittest_working_dir(gba WORKING_DIR)
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:giibiiadvance>
+            $<TARGET_FILE:pngmatch>
+            ${TEST_SCRIPT_1}
+            ${GBA_ROM}
+            ${TEST_SCRIPT_2}
+            ${REF_PNG}
+        )
+
         add_test(NAME ${EXECUTABLE_NAME}_gba_test
             COMMAND ${CMAKE_COMMAND}
                         -DCMD1=${CMD1}
                         -DCMD2=${CMD2}
                         -DCMD3=${CMD3}
+                        ${CACHE_ARGS}
                         -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
-            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+            WORKING_DIRECTORY ${WORKING_DIR}
         )
         set_tests_properties(${EXECUTABLE_NAME}_gba_test
             PROPERTIES LABELS "${GROUP_NAME};gba"
@@ -1,6 +1,6 @@
 # SPDX-License-Identifier: MIT
 #
-# Copyright (c) 2020 Antonio Niño Díaz
+# Copyright (c) 2020-2022 Antonio Niño Díaz
 
 cmake_minimum_required(VERSION 3.15)
 
@@ -18,6 +18,48 @@ macro(exec_check command)
     endif()
 endmacro()
 
+# Cache of test results
+# ---------------------
+#
+# CACHE_FILES is a list of all the files that the result of the test depends on,
+# separated by '|' (';' can't be used in the arguments of add_test()). If the
+# hashes of the files, the commands and this script are the same as the last
+# time that the test passed, the commands aren't run again.
+
+set(CACHE_KEY_FILE "test-cache-key.txt")
+
+if(NOT "${CACHE_FILES}" STREQUAL "")
+    string(REPLACE "|" ";" CACHE_FILES_LIST "${CACHE_FILES}")
+    list(APPEND CACHE_FILES_LIST "${CMAKE_CURRENT_LIST_FILE}")
+
+    set(CACHE_KEY "${CMD1}\n${CMD2}\n${CMD3}\n")
+
+    foreach(CACHE_FILE ${CACHE_FILES_LIST})
+        if(EXISTS "${CACHE_FILE}")
+            file(SHA256 "${CACHE_FILE}" FILE_HASH)
+        else()
+            set(FILE_HASH "missing")
+        endif()
+        string(APPEND CACHE_KEY "${CACHE_FILE}: ${FILE_HASH}\n")
+    endforeach()
+
+    string(SHA256 CACHE_KEY "${CACHE_KEY}")
+
+    if(EXISTS "${CACHE_KEY_FILE}")
+        file(READ "${CACHE_KEY_FILE}" CACHE_KEY_OLD)
+        if("${CACHE_KEY_OLD}" STREQUAL "${CACHE_KEY}")
+            message(STATUS "Inputs unchanged since the last pass: cached pass")
+            return()
+        endif()
+
+        # Remove the old key so that a failed run is never seen as a pass
+        file(REMOVE "${CACHE_KEY_FILE}")
+    endif()
+endif()
+
+# Run commands
+# ------------
+
 if(NOT "${CMD1}" STREQUAL "")
     exec_check(${CMD1})
 endif()
@@ -27,3 +69,7 @@ endif()
 if(NOT "${CMD3}" STREQUAL "")
     exec_check(${CMD3})
 endif()
+
+if(NOT "${CACHE_FILES}" STREQUAL "")
+    file(WRITE "${CACHE_KEY_FILE}" "${CACHE_KEY}")
+endif()
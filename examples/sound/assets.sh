@@ -14,6 +14,7 @@ echo "[*] Converting ${IN}..."
 echo ""
 
 (cd gbt_player && bash assets.sh)
+(cd gbt_player_lz77 && bash assets.sh)
 (cd umod && bash assets.sh)
 
 exit 0
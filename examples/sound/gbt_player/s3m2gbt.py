@@ -575,10 +575,12 @@ STARTUP_CMD_DONE                = 0
 STARTUP_CMD_SPEED               = 1
 STARTUP_CMD_PANING              = 2
 STARTUP_CMD_CHANNEL3_INSTRUMENT = 3
+STARTUP_CMD_ROW_INDEX           = 4
+STARTUP_CMD_LZ77                = 5
 
 SAMPLE_64_ENTRIES = 1 << 7
 
-def initial_state_array(speed, panning_array, instruments):
+def initial_state_array(speed, panning_array, instruments, row_index, lz77):
     array = []
 
     # Initial speed
@@ -626,6 +628,18 @@ def initial_state_array(speed, panning_array, instruments):
                     value = (sample_hi << 4) | sample_lo
                     array.extend([value])
 
+    # Row index
+    # ---------
+
+    if row_index:
+        array.extend([STARTUP_CMD_ROW_INDEX])
+
+    # LZ77-compressed patterns
+    # ------------------------
+
+    if lz77:
+        array.extend([STARTUP_CMD_LZ77])
+
     # End commands
     # ------------
 
@@ -633,7 +647,83 @@ def initial_state_array(speed, panning_array, instruments):
 
     return array
 
-def convert_file(module_path, song_name, output_path, export_instruments):
+# Compresses data with the LZ77 format used by the GBA BIOS. The header is a
+# 32-bit word with 0x10 in the bottom 8 bits and the uncompressed size in the
+# top 24 bits. Each block starts with a byte of flags (MSB first) followed by 8
+# elements. If the flag is 0 the element is a literal byte. If it's 1 it's a
+# reference to previous data: 4 bits with the length - 3 and 12 bits with the
+# displacement - 1, big endian.
+def lz77_compress(data):
+    out = [0x10, len(data) & 0xFF, (len(data) >> 8) & 0xFF, len(data) >> 16]
+
+    pos = 0
+    while pos < len(data):
+        flags_index = len(out)
+        out.append(0)
+
+        for bit in range(0, 8):
+            if pos == len(data):
+                break
+
+            # Look for the longest match in the window
+            best_len = 0
+            best_disp = 0
+            max_len = min(18, len(data) - pos)
+            for disp in range(1, min(pos, 4096) + 1):
+                length = 0
+                while length < max_len and \
+                      data[pos + length] == data[pos - disp + length]:
+                    length += 1
+                if length > best_len:
+                    best_len = length
+                    best_disp = disp
+                    if length == max_len:
+                        break
+
+            if best_len >= 3:
+                out[flags_index] |= 0x80 >> bit
+                out.append(((best_len - 3) << 4) | ((best_disp - 1) >> 8))
+                out.append((best_disp - 1) & 0xFF)
+                pos += best_len
+            else:
+                out.append(data[pos])
+                pos += 1
+
+    # The BIOS expects the size of the data to be a multiple of 4
+    while len(out) % 4 != 0:
+        out.append(0)
+
+    return out
+
+# In the stream format, a run of up to EMPTY_ROWS_MAX rows in which all channels
+# are empty can be stored as one byte in place of the header of channel 1. It
+# has no flags set, and the number of rows in the bottom 4 bits. Returns the
+# list of entries of the pattern and the index of the entry of each row.
+EMPTY_ROWS_MAX = 15
+
+def encode_empty_rows(rows):
+    entries = []
+    row_entries = []
+    run = 0
+
+    for r in rows:
+        if r == [0, 0, 0, 0]:
+            if run == 0 or run == EMPTY_ROWS_MAX:
+                entries.append([1])
+                run = 1
+            else:
+                run += 1
+                entries[-1][0] = run
+        else:
+            entries.append(r)
+            run = 0
+
+        row_entries.append(len(entries) - 1)
+
+    return entries, row_entries
+
+def convert_file(module_path, song_name, output_path, export_instruments,
+                 row_index, lz77, skip_empty_rows):
 
     with open(module_path, "rb") as file:
         file_byte_array = bytearray(file.read())
@@ -653,6 +743,9 @@ def convert_file(module_path, song_name, output_path, export_instruments):
 
         print(f"Exporting patterns...")
 
+        size_stream = 0
+        size_compressed = 0
+
         pattern = -1
         for p in s3m.patterns:
             pattern += 1
@@ -666,6 +759,7 @@ def convert_file(module_path, song_name, output_path, export_instruments):
             fileout.write(f"static const uint8_t {song_name}_{pattern}[] = {{\n")
 
             row = 0
+            rows = []
 
             cmd1 = [0]
             cmd2 = [0]
@@ -680,14 +774,8 @@ def convert_file(module_path, song_name, output_path, export_instruments):
                 # marker right at the end of each pattern.
                 if c.empty:
 
-                    # Write row
-                    fileout.write("    ")
-
-                    cmd = cmd1 + cmd2 + cmd3 + cmd4
-                    for b in cmd:
-                        fileout.write(f"0x{b:02X},")
-
-                    fileout.write("\n")
+                    # Save row
+                    rows.append(cmd1 + cmd2 + cmd3 + cmd4)
 
                     row = row + 1
 
@@ -746,9 +834,70 @@ def convert_file(module_path, song_name, output_path, export_instruments):
                     e.channel = channel
                     raise e
 
+            # In the stream format each row is a list of bytes, but runs of
+            # empty rows can be stored as one entry. For each row, row_entries
+            # has the index of the entry where it is stored.
+            if skip_empty_rows:
+                entries, row_entries = encode_empty_rows(rows)
+            else:
+                entries = rows
+                row_entries = list(range(len(rows)))
+
+            # The row index is a table with the offset from the start of the
+            # pattern to each row (16 bit, little endian). All rows of a run of
+            # empty rows point to the same entry.
+            offsets = []
+            if row_index:
+                entry_offsets = []
+                offset = len(rows) * 2
+                for e in entries:
+                    entry_offsets.append(offset)
+                    offset += len(e)
+
+                for i in row_entries:
+                    offset = entry_offsets[i]
+                    offsets.extend([offset & 0xFF, offset >> 8])
+
+            size_stream += len(offsets) + len(sum(entries, []))
+
+            if lz77:
+                data = offsets + sum(entries, [])
+                compressed = lz77_compress(data)
+
+                size_compressed += len(compressed)
+
+                for i in range(0, len(compressed), 16):
+                    fileout.write("    ")
+                    for b in compressed[i:i + 16]:
+                        fileout.write(f"0x{b:02X},")
+                    fileout.write("\n")
+
+                fileout.write("};\n")
+                fileout.write("\n")
+                continue
+
+            for i in range(0, len(offsets), 16):
+                fileout.write("    ")
+                for b in offsets[i:i + 16]:
+                    fileout.write(f"0x{b:02X},")
+                fileout.write("\n")
+
+            for e in entries:
+                fileout.write("    ")
+                for b in e:
+                    fileout.write(f"0x{b:02X},")
+                fileout.write("\n")
+
             fileout.write("};\n")
             fileout.write("\n")
 
+        if skip_empty_rows:
+            print(f"Patterns use {size_stream} bytes after merging empty rows")
+
+        if lz77:
+            print(f"Patterns compressed from {size_stream} to "
+                  f"{size_compressed} bytes")
+
         # Export initial state
         # --------------------
 
@@ -771,7 +920,8 @@ def convert_file(module_path, song_name, output_path, export_instruments):
         if export_instruments:
             instr = s3m.instruments
 
-        state_array = initial_state_array(s3m.initial_speed, gb_default_pan, instr)
+        state_array = initial_state_array(s3m.initial_speed, gb_default_pan,
+                                          instr, row_index, lz77)
 
         # Write rows of 8 bytes until the end of the array
         while True:
@@ -835,11 +985,23 @@ if __name__ == "__main__":
                         help="output file")
     parser.add_argument("--instruments", default=False, required=False,
                         action='store_true', help="export channel 3 instruments")
+    parser.add_argument("--row-index", default=False, required=False,
+                        action='store_true',
+                        help="export a table with the offset to each row of the patterns")
+    parser.add_argument("--lz77", default=False, required=False,
+                        action='store_true',
+                        help="compress patterns with the LZ77 format of the BIOS "
+                             "(GBT Player needs to be built with GBT_SUPPORT_LZ77)")
+    parser.add_argument("--skip-empty-rows", default=False, required=False,
+                        action='store_true',
+                        help="store runs of empty rows as a single byte")
 
     args = parser.parse_args()
 
     try:
-        convert_file(args.input, args.name, args.output, args.instruments)
+        convert_file(args.input, args.name, args.output, args.instruments,
+                     args.row_index, args.lz77,
+                     args.skip_empty_rows)
     except RowConversionError as e:
         print("ERROR: " + str(e))
         sys.exit(1)
@@ -14,11 +14,55 @@
 
 #include "gbt_player.h"
 
-typedef int (*effect_handler)(uint32_t args);
+typedef int (*effect_handler)(uint32_t ch, uint32_t args);
+
+// If GBT_SUPPORT_LZ77 is defined, songs with LZ77-compressed patterns can be
+// played. This needs two buffers of 1152 bytes in EWRAM, so it's optional.
+#ifdef GBT_SUPPORT_LZ77
+
+// Number of bytes of LZ77-compressed patterns decompressed in each call to
+// gbt_update() while the pattern that comes next in the song is prefetched.
+// Songs are played at one tick per frame. If a pattern is played from start to
+// end it lasts at least 64 ticks, so 32 bytes per tick are enough to decompress
+// the biggest possible pattern before it's needed.
+//
+// Pattern jump and pattern break effects, gbt_play() and gbt_set_position() can
+// change to a pattern that hasn't been decompressed. In that case the whole
+// pattern is decompressed in the ticks left until the next row: with a song
+// speed of N ticks per row, each of those ticks decompresses up to 1 / N of the
+// biggest possible pattern. With speed 1, and in the first gbt_update() after
+// a call to gbt_set_position(), the whole pattern is decompressed in one tick.
+#ifndef GBT_LZ77_BYTES_PER_TICK
+# define GBT_LZ77_BYTES_PER_TICK    32
+#endif
+
+// Size of the biggest possible pattern: a row index and 64 rows with all the
+// fields present in all channels.
+#define LZ77_BUFFER_SIZE    (64 * 2 + 64 * 4 * 4)
+
+#endif // GBT_SUPPORT_LZ77
+
+// If GBT_TICK_IN_IWRAM is defined, all the code that runs every time
+// gbt_update() is called is placed in IWRAM and built as ARM code. This is
+// faster than running Thumb code from ROM, at the cost of some IWRAM.
+#ifdef GBT_TICK_IN_IWRAM
+# define GBT_TICK_CODE      IWRAM_CODE ARM_CODE
+#else
+# define GBT_TICK_CODE
+#endif
 
 // Player state
 // ============
 
+// Indices of the channels in the arrays of the player state
+
+#define CH1                 0
+#define CH2                 1
+#define CH3                 2
+#define CH4                 3
+
+#define GBT_NUM_CHANNELS    4
+
 typedef struct {
 
     // Array of commands to run before the start of the song (or NULL)
@@ -29,6 +73,8 @@ typedef struct {
 
     // Pointer to next row data
     const uint8_t *current_row_data_ptr;
+    // Number of empty rows left before reading current_row_data_ptr again
+    uint8_t empty_rows_left;
 
     uint8_t playing;
     uint8_t loop_enabled;
@@ -48,69 +94,64 @@ typedef struct {
     // enabled by default.
     uint8_t channels_disabled;
 
-    struct {
-        uint16_t pan;
-        uint16_t vol;
-        uint16_t instr;
-        uint16_t freq; // Active frequence
-        uint16_t base_freq; // Original frequence read from the pattern
-
-        // Arpeggio
-        uint8_t arpeggio_freq_index[3]; // { base_index, index + x, index + y }
-        uint8_t arpeggio_enabled; // if 0, disabled
-        uint8_t arpeggio_tick;
-
-        // Vibrato
-        uint8_t vibrato_enabled; // if 0, disabled
-        uint8_t vibrato_position;
-        uint8_t vibrato_args;
-
-        // Volume slide
-        uint16_t volslide_args;
-
-        // Cut note
-        uint8_t cut_note_tick; // If tick == gbt.cut_note_tick, stop note.
-    } ch1, ch2;
-
-    struct {
-        uint16_t pan;
-        uint16_t vol;
-        uint16_t instr;
-        uint16_t freq; // Active frequence
-        uint16_t base_freq; // Original frequence read from the pattern
-
-        // Arpeggio
-        uint8_t arpeggio_freq_index[3]; // { base_index, index + x, index + y }
-        uint8_t arpeggio_enabled; // if 0, disabled
-        uint8_t arpeggio_tick;
-
-        // Vibrato
-        uint8_t vibrato_enabled; // if 0, disabled
-        uint8_t vibrato_position;
-        uint8_t vibrato_args;
-
-        // Cut note
-        uint8_t cut_note_tick; // If tick == gbt.cut_note_tick, stop note.
-
-        // Currently loaded instrument (0xFF if none)
-        uint8_t loaded_instrument;
-
-        // Channel 3 instruments
-        uint8_t instrument_flags[8];
-        const uint8_t *instrument[8];
-    } ch3;
-
-    struct {
-        uint16_t pan;
-        uint16_t vol;
-        uint16_t instr;
-
-        // Volume slide
-        uint16_t volslide_args;
-
-        // Cut note
-        uint8_t cut_note_tick; // If tick == gbt.cut_note_tick, stop note.
-    } ch4;
+    // If 1, each pattern starts with a table of offsets to each row
+    uint8_t has_row_index;
+    // If 1, patterns are compressed with the LZ77 format of the GBA BIOS
+    uint8_t has_lz77_patterns;
+
+    // State of the channels. Each array has one entry per channel, indexed by
+    // CH1 to CH4. Not all fields are used by all channels.
+
+    uint16_t pan[GBT_NUM_CHANNELS];
+    uint16_t vol[GBT_NUM_CHANNELS];
+    uint16_t instr[GBT_NUM_CHANNELS];
+    uint16_t freq[GBT_NUM_CHANNELS]; // Active frequence
+    uint16_t base_freq[GBT_NUM_CHANNELS]; // Original frequence read from the pattern
+
+    uint8_t note_index[GBT_NUM_CHANNELS]; // Last note read from the pattern
+
+    // Arpeggio (channels 1 to 3)
+    uint16_t arpeggio_freq[GBT_NUM_CHANNELS][3]; // { base, note + x, note + y }
+    uint8_t arpeggio_enabled[GBT_NUM_CHANNELS]; // if 0, disabled
+    uint8_t arpeggio_tick[GBT_NUM_CHANNELS];
+
+    // Vibrato (channels 1 to 3)
+    uint8_t vibrato_enabled[GBT_NUM_CHANNELS]; // if 0, disabled
+    uint8_t vibrato_position[GBT_NUM_CHANNELS];
+    uint8_t vibrato_args[GBT_NUM_CHANNELS];
+    // Frequency for each position of the vibrato, calculated by
+    // gbt_channel_prepare_vibrato(). It only depends on the depth and the base
+    // frequency, so it is only calculated again when one of them changes.
+    uint16_t vibrato_freq[CH3 + 1][64];
+    uint8_t vibrato_freq_depth[CH3 + 1]; // 0xFF if the table isn't valid
+    uint16_t vibrato_freq_base[CH3 + 1];
+
+    // Volume slide (channels 1, 2 and 4)
+    uint16_t volslide_args[GBT_NUM_CHANNELS];
+
+    // Cut note
+    uint8_t cut_note_tick[GBT_NUM_CHANNELS]; // If tick == cut_note_tick, stop note.
+
+    // Currently loaded channel 3 instrument (0xFF if none)
+    uint8_t ch3_loaded_instrument;
+
+    // Instruments of 32 samples only use one of the two banks of wave RAM, and
+    // the CPU can write to the bank that isn't being played. The next
+    // instrument is written to it in advance, and then the banks are switched.
+    uint8_t ch3_bank_instrument[2]; // Instrument in each bank (0xFF if none)
+    uint8_t ch3_playing_bank;
+    uint8_t ch3_lookahead; // 1 if the next instrument has to be looked for
+
+    // Channel 3 instruments
+    uint8_t ch3_instrument_flags[8];
+    const uint8_t *ch3_instrument[8];
+
+    // Values of the registers of the channels, to be written to the hardware
+    // at the end of the tick by gbt_flush_registers().
+    uint16_t reg_envelope[GBT_NUM_CHANNELS]; // Volume, envelope and duty
+    uint16_t reg_control[GBT_NUM_CHANNELS]; // Frequency and restart bit
+    uint8_t regs_dirty; // One bit per channel that needs to be written
+    uint8_t ch3_pending_instrument; // Instrument to load (0xFF if none)
 
     // The volume setting in REG_SOUNDCNT_L can't actually silence the music.
     // The best it can do is set it to 1/8th of the maximum volume. To be able
@@ -125,10 +166,69 @@ typedef struct {
 
     gbt_event_callback event_callback;
 
+#ifdef GBT_SUPPORT_LZ77
+    // LZ77-compressed patterns are decompressed to one of two buffers. One of
+    // them has the pattern that is being played, and the next pattern of the
+    // song is decompressed to the other one a few bytes every tick.
+    uint8_t lz77_buffer[2][LZ77_BUFFER_SIZE];
+    const uint8_t *lz77_pattern[2]; // Pattern in each buffer (NULL if none)
+    uint8_t lz77_current; // Buffer with the pattern that is being played
+
+    // State of the decompression to the buffer that isn't being played
+    const uint8_t *lz77_decoding; // Pattern being decompressed (or NULL)
+    uint8_t lz77_needed; // 1 if lz77_decoding is needed for the next row
+    uint8_t lz77_wait; // 1 if the current row has to be found when it's done
+    const uint8_t *lz77_src; // Next byte to read of the compressed pattern
+    uint16_t lz77_size; // Size of the decompressed pattern
+    uint16_t lz77_written; // Bytes written to the buffer
+    uint8_t lz77_flags; // Flags of the current block
+    uint8_t lz77_flags_left; // Elements left in the current block
+    uint8_t lz77_copy_left; // Bytes left to copy of the current reference
+    uint16_t lz77_copy_disp; // Displacement of the current reference
+#endif
+
+#ifdef GBT_COUNT_REGISTER_WRITES
+    // Number of writes to hardware registers done by gbt_update()
+    int reg_writes; // During the current call
+    int reg_writes_last; // During the last call
+    int reg_writes_max; // Maximum since the song started
+#endif
+
+#ifdef GBT_COUNT_CYCLES
+    // Number of CPU cycles taken by gbt_update() since the song started
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+    uint64_t cycles_total;
+    uint32_t cycles_count; // Number of calls to gbt_update() measured
+#endif
+
 } gbt_player_info_t;
 
 EWRAM_BSS static gbt_player_info_t gbt;
 
+// If GBT_COUNT_CYCLES is defined, timers 2 and 3 are used to measure the number
+// of CPU cycles taken by gbt_update(). Timer 2 runs at the CPU clock and timer
+// 3 counts its overflows. The user can't use them while the song is playing.
+#ifdef GBT_COUNT_CYCLES
+# define GBT_TIMER_CASCADE  (1 << 2) // Prescaler 1 if this isn't set
+# define GBT_TIMER_START    (1 << 7)
+#endif
+
+// All writes to hardware registers are done with this macro so that they can
+// be counted if GBT_COUNT_REGISTER_WRITES is defined.
+#ifdef GBT_COUNT_REGISTER_WRITES
+# define GBT_REG_WRITE(reg, value)  \
+    do {                            \
+        (reg) = (value);            \
+        gbt.reg_writes++;           \
+    } while (0)
+#else
+# define GBT_REG_WRITE(reg, value)  \
+    do {                            \
+        (reg) = (value);            \
+    } while (0)
+#endif
+
 // Player constants
 // ================
 
@@ -193,136 +293,561 @@ static const int16_t vibrato_sine[64] = {
 // Channel handling routines
 // =========================
 
-static void channel1_refresh_registers(void)
+// These functions don't write to the hardware registers. They save the new
+// values in the player state and gbt_flush_registers() writes them at the end
+// of the tick. This way each register is written at most once per tick, even if
+// a channel is refreshed several times during the same tick.
+
+GBT_TICK_CODE static void channel1_refresh_registers(void)
+{
+    gbt.reg_envelope[CH1] = gbt.instr[CH1] | gbt.vol[CH1] | gbt.volslide_args[CH1];
+    gbt.reg_control[CH1] = SOUND1CNT_X_RESTART | gbt.freq[CH1];
+    gbt.regs_dirty |= BIT(CH1);
+}
+
+GBT_TICK_CODE static void channel1_silence(void)
+{
+    gbt.reg_envelope[CH1] = 0; // Set volume to 0
+    gbt.reg_control[CH1] = SOUND1CNT_X_RESTART;
+    gbt.regs_dirty |= BIT(CH1);
+}
+
+GBT_TICK_CODE static void channel2_refresh_registers(void)
 {
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_1_ENABLE_RIGHT | SOUNDCNT_L_PSG_1_ENABLE_LEFT);
-    // Panning is set to the right values at the end of the row handling
+    gbt.reg_envelope[CH2] = gbt.instr[CH2] | gbt.vol[CH2] | gbt.volslide_args[CH2];
+    gbt.reg_control[CH2] = SOUND2CNT_H_RESTART | gbt.freq[CH2];
+    gbt.regs_dirty |= BIT(CH2);
+}
 
-    REG_SOUND1CNT_L = 0;
-    REG_SOUND1CNT_H = gbt.ch1.instr | gbt.ch1.vol | gbt.ch1.volslide_args;
-    REG_SOUND1CNT_X = SOUND1CNT_X_RESTART | gbt.ch1.freq;
+GBT_TICK_CODE static void channel2_silence(void)
+{
+    gbt.reg_envelope[CH2] = 0; // Set volume to 0
+    gbt.reg_control[CH2] = SOUND2CNT_H_RESTART;
+    gbt.regs_dirty |= BIT(CH2);
 }
 
-static void channel1_silence(void)
+GBT_TICK_CODE static void channel3_refresh_registers(void)
 {
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_1_ENABLE_RIGHT | SOUNDCNT_L_PSG_1_ENABLE_LEFT);
+    // Only load the instrument if it isn't already in wave RAM
+    uint32_t instr = gbt.instr[CH3];
+
+    if (gbt.ch3_loaded_instrument != instr)
+        gbt.ch3_pending_instrument = instr;
+    else
+        gbt.ch3_pending_instrument = 0xFF;
 
-    REG_SOUND1CNT_L = 0;
-    REG_SOUND1CNT_H = 0; // Set volume to 0
-    REG_SOUND1CNT_X = SOUND1CNT_X_RESTART;
+    gbt.reg_envelope[CH3] = gbt.vol[CH3];
+    gbt.reg_control[CH3] = SOUND3CNT_X_RESTART | gbt.freq[CH3];
+    gbt.regs_dirty |= BIT(CH3);
 }
 
-static void channel2_refresh_registers(void)
+GBT_TICK_CODE static void channel3_silence(void)
 {
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_2_ENABLE_RIGHT | SOUNDCNT_L_PSG_2_ENABLE_LEFT);
-    // Panning is set to the right values at the end of the row handling
+    gbt.reg_envelope[CH3] = SOUND3CNT_H_VOLUME_0;
+    gbt.reg_control[CH3] = SOUND3CNT_X_RESTART;
+    gbt.regs_dirty |= BIT(CH3);
+}
 
-    REG_SOUND2CNT_L = gbt.ch2.instr | gbt.ch2.vol | gbt.ch2.volslide_args;
-    REG_SOUND2CNT_H = SOUND2CNT_H_RESTART | gbt.ch2.freq;
+// Writes 32 samples to the bank of wave RAM that isn't being played
+GBT_TICK_CODE static void channel3_write_wave(const uint8_t *wave)
+{
+    for (int i = 0; i < 16; i += 2)
+    {
+        uint16_t wave_lo = *wave++;
+        uint16_t wave_hi = *wave++;
+        GBT_REG_WRITE(REG_WAVE_RAM[i / 2], wave_lo | (wave_hi << 8));
+    }
 }
 
-static void channel2_silence(void)
+// Writes an instrument of 32 samples to the bank that isn't being played, if it
+// isn't there already. This can be done while the channel is playing.
+GBT_TICK_CODE static void channel3_preload_instrument(uint32_t instr)
 {
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_2_ENABLE_RIGHT | SOUNDCNT_L_PSG_2_ENABLE_LEFT);
+    uint32_t bank = gbt.ch3_playing_bank ^ 1;
 
-    REG_SOUND2CNT_L = 0; // Set volume to 0
-    REG_SOUND2CNT_H = SOUND2CNT_H_RESTART;
+    if (gbt.ch3_bank_instrument[bank] == instr)
+        return;
+
+    channel3_write_wave(gbt.ch3_instrument[instr]);
+    gbt.ch3_bank_instrument[bank] = instr;
 }
 
-static void channel3_refresh_registers(void)
+GBT_TICK_CODE static void channel3_load_instrument(uint32_t instr)
 {
+    uint8_t flags = gbt.ch3_instrument_flags[instr];
+
+    // The next instrument will be looked for in the pattern after this one
+    gbt.ch3_lookahead = 1;
+    gbt.ch3_loaded_instrument = instr;
+
+    if ((flags & BIT(7)) == 0) // 32 samples
+    {
+        // Write the instrument to the bank that isn't being played (unless it
+        // has been preloaded) and switch banks. There is no need to stop the
+        // channel.
+        channel3_preload_instrument(instr);
+
+        uint32_t bank = gbt.ch3_playing_bank ^ 1;
+        GBT_REG_WRITE(REG_SOUND3CNT_L, SOUND3CNT_L_SIZE_32 |
+                      SOUND3CNT_L_BANK_SET(bank) | SOUND3CNT_L_ENABLE);
+        gbt.ch3_playing_bank = bank;
+        return;
+    }
+
+    // Instruments of 64 samples use both banks, so the channel has to be
+    // stopped to write them.
+    //
     // On the GBA, the output of channel 3 is inverted. This causes the channel
     // to output a loud spike when disabled. It’s a good idea to "remove" the
     // channel using NR51 (SOUNDCNT_L) before refreshing wave RAM.
 
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_3_ENABLE_RIGHT | SOUNDCNT_L_PSG_3_ENABLE_LEFT);
-    // Panning is set to the right values at the end of the row handling
+    GBT_REG_WRITE(REG_SOUNDCNT_L, REG_SOUNDCNT_L &
+            ~(SOUNDCNT_L_PSG_3_ENABLE_RIGHT | SOUNDCNT_L_PSG_3_ENABLE_LEFT));
+    // Panning is set to the right values at the end of the tick
+
+    const uint8_t *wave = gbt.ch3_instrument[instr];
+
+    // Disable channel and set bank 0 as writable
+    GBT_REG_WRITE(REG_SOUND3CNT_L, SOUND3CNT_L_DISABLE | SOUND3CNT_L_BANK_SET(1));
+    channel3_write_wave(wave);
+
+    // Disable channel and set bank 1 as writable
+    GBT_REG_WRITE(REG_SOUND3CNT_L, SOUND3CNT_L_DISABLE | SOUND3CNT_L_BANK_SET(0));
+    channel3_write_wave(wave + 16);
+
+    // Use the 64 samples mode
+    GBT_REG_WRITE(REG_SOUND3CNT_L, SOUND3CNT_L_SIZE_64 | SOUND3CNT_L_ENABLE);
+
+    // None of the banks has an instrument of 32 samples now
+    gbt.ch3_bank_instrument[0] = 0xFF;
+    gbt.ch3_bank_instrument[1] = 0xFF;
+    gbt.ch3_playing_bank = 0;
+}
+
+GBT_TICK_CODE static void channel4_refresh_registers(void)
+{
+    gbt.reg_envelope[CH4] = gbt.vol[CH4] | gbt.volslide_args[CH4]; // Volume slide index 2
+    gbt.reg_control[CH4] = SOUND4CNT_H_RESTART | gbt.instr[CH4];
+    gbt.regs_dirty |= BIT(CH4);
+}
+
+GBT_TICK_CODE static void channel4_silence(void)
+{
+    gbt.reg_envelope[CH4] = 0; // Set volume to 0
+    gbt.reg_control[CH4] = SOUND4CNT_H_RESTART;
+    gbt.regs_dirty |= BIT(CH4);
+}
+
+// The channel is selected with a switch instead of a table of function pointers
+// so that the compiler can inline the functions above.
+
+GBT_TICK_CODE static void gbt_channel_refresh_registers(uint32_t ch)
+{
+    switch (ch)
+    {
+        case CH1:
+            channel1_refresh_registers();
+            break;
+        case CH2:
+            channel2_refresh_registers();
+            break;
+        case CH3:
+            channel3_refresh_registers();
+            break;
+        case CH4:
+            channel4_refresh_registers();
+            break;
+    }
+}
+
+GBT_TICK_CODE static void gbt_channel_silence(uint32_t ch)
+{
+    switch (ch)
+    {
+        case CH1:
+            channel1_silence();
+            break;
+        case CH2:
+            channel2_silence();
+            break;
+        case CH3:
+            channel3_silence();
+            break;
+        case CH4:
+            channel4_silence();
+            break;
+    }
+}
+
+// Writes the registers of all the channels that have been refreshed or silenced
+// since the last call. It returns a mask with one bit per channel written.
+GBT_TICK_CODE static uint32_t gbt_flush_channel_registers(void)
+{
+    uint32_t dirty = gbt.regs_dirty;
 
-    uint32_t instr = gbt.ch3.instr;
+    gbt.regs_dirty = 0;
 
-    if (gbt.ch3.loaded_instrument != instr)
+    if (dirty & BIT(CH1))
     {
-        const uint8_t *wave = gbt.ch3.instrument[instr];
-        uint8_t flags = gbt.ch3.instrument_flags[instr];
+        GBT_REG_WRITE(REG_SOUND1CNT_L, 0);
+        GBT_REG_WRITE(REG_SOUND1CNT_H, gbt.reg_envelope[CH1]);
+        GBT_REG_WRITE(REG_SOUND1CNT_X, gbt.reg_control[CH1]);
+    }
 
-        // Disable channel and set bank 0 as writable
-        REG_SOUND3CNT_L = SOUND3CNT_L_DISABLE | SOUND3CNT_L_BANK_SET(1);
+    if (dirty & BIT(CH2))
+    {
+        GBT_REG_WRITE(REG_SOUND2CNT_L, gbt.reg_envelope[CH2]);
+        GBT_REG_WRITE(REG_SOUND2CNT_H, gbt.reg_control[CH2]);
+    }
 
-        for (int i = 0; i < 16; i += 2)
+    if (dirty & BIT(CH3))
+    {
+        if (gbt.ch3_pending_instrument != 0xFF)
         {
-            uint16_t wave_lo = *wave++;
-            uint16_t wave_hi = *wave++;
-            REG_WAVE_RAM[i / 2] = wave_lo | (wave_hi << 8);
+            channel3_load_instrument(gbt.ch3_pending_instrument);
+            gbt.ch3_pending_instrument = 0xFF;
         }
 
-        if (flags & BIT(7)) // 64 samples
+        GBT_REG_WRITE(REG_SOUND3CNT_H, gbt.reg_envelope[CH3]);
+        GBT_REG_WRITE(REG_SOUND3CNT_X, gbt.reg_control[CH3]);
+    }
+
+    if (dirty & BIT(CH4))
+    {
+        GBT_REG_WRITE(REG_SOUND4CNT_L, gbt.reg_envelope[CH4]);
+        GBT_REG_WRITE(REG_SOUND4CNT_H, gbt.reg_control[CH4]);
+    }
+
+    return dirty;
+}
+
+// Channel descriptions
+// ====================
+
+// Effects
+
+#define EFFECT_PAN              0
+#define EFFECT_ARPEGGIO         1
+#define EFFECT_NOTE_CUT         2
+#define EFFECT_VIBRATO          3
+#define EFFECT_VOLUME_SLIDE     4
+#define EFFECT_PATTERN_JUMP     8
+#define EFFECT_BREAK_SET_STEP   9
+#define EFFECT_SPEED            10
+#define EFFECT_EVENT            15
+
+#define EFFECTS_ALL_CHANNELS \
+    (BIT(EFFECT_PAN) | BIT(EFFECT_NOTE_CUT) | BIT(EFFECT_PATTERN_JUMP) | \
+     BIT(EFFECT_BREAK_SET_STEP) | BIT(EFFECT_SPEED) | BIT(EFFECT_EVENT))
+
+// Everything that is different between channels, apart from the code that
+// writes to the hardware registers, is described by this struct. This way the
+// rest of the player can handle all channels with the same code.
+typedef struct {
+    // Mask of the effects supported by this channel
+    uint16_t effects;
+
+    // Volume = (header & vol_mask) << vol_shift
+    uint8_t vol_mask;
+    uint8_t vol_shift;
+
+    // Instrument = ((effect byte >> 4) & instr_mask) << instr_shift
+    uint8_t instr_mask;
+    uint8_t instr_shift;
+} gbt_channel_info_t;
+
+static const gbt_channel_info_t gbt_channel_info[GBT_NUM_CHANNELS] = {
+    [CH1] = {
+        EFFECTS_ALL_CHANNELS | BIT(EFFECT_ARPEGGIO) | BIT(EFFECT_VIBRATO) |
+        BIT(EFFECT_VOLUME_SLIDE),
+        0xF, 12, 0x3, 6
+    },
+    [CH2] = {
+        EFFECTS_ALL_CHANNELS | BIT(EFFECT_ARPEGGIO) | BIT(EFFECT_VIBRATO) |
+        BIT(EFFECT_VOLUME_SLIDE),
+        0xF, 12, 0x3, 6
+    },
+    [CH3] = {
+        EFFECTS_ALL_CHANNELS | BIT(EFFECT_ARPEGGIO) | BIT(EFFECT_VIBRATO),
+        0x7, 13, 0x7, 0
+    },
+    [CH4] = {
+        EFFECTS_ALL_CHANNELS | BIT(EFFECT_VOLUME_SLIDE),
+        0xF, 12, 0x0, 0 // Channel 4 doesn't have instruments, only kits
+    },
+};
+
+// Player routines
+// ===============
+
+// In the stream format, runs of rows in which all channels are empty can be
+// stored as a single byte in place of the header of channel 1. It doesn't have
+// any flag set, and the bottom 4 bits are the number of rows (1 to 15). A
+// header that is 0 is still just an empty channel.
+
+#define IS_EMPTY_ROWS(header)       (((header) != 0) && (((header) & 0xF0) == 0))
+#define EMPTY_ROWS_COUNT(header)    ((header) & 0x0F)
+
+#ifdef GBT_SUPPORT_LZ77
+
+// Songs with LZ77-compressed patterns use the format of the GBA BIOS. There is
+// a 32-bit header with the decompressed size in the top 24 bits. Then, there
+// are blocks of 8 elements preceded by a byte with one flag per element (MSB
+// first). A flag set to 0 means that the element is one byte to copy to the
+// output. A flag set to 1 means that the element is a reference to data already
+// written to the output: 2 bytes with the number of bytes to copy minus 3 (4
+// bits) and the displacement minus 1 (12 bits).
+//
+// The BIOS functions can't be used because they need to decompress the whole
+// pattern in one go, which can take longer than a frame. This decompressor can
+// stop after any number of bytes and continue in the next tick.
+
+GBT_TICK_CODE static void gbt_lz77_start(const uint8_t *pattern)
+{
+    const uint8_t *src = pattern;
+
+    uint32_t size = src[1] | (src[2] << 8) | (src[3] << 16);
+    if (size > LZ77_BUFFER_SIZE)
+        size = LZ77_BUFFER_SIZE; // This should never happen
+
+    gbt.lz77_decoding = pattern;
+    gbt.lz77_src = src + 4;
+    gbt.lz77_size = size;
+    gbt.lz77_written = 0;
+    gbt.lz77_flags_left = 0;
+    gbt.lz77_copy_left = 0;
+    gbt.lz77_needed = 0;
+
+    gbt.lz77_pattern[gbt.lz77_current ^ 1] = NULL;
+}
+
+// Decompresses up to the specified number of bytes of the pattern that is
+// being decompressed, if any.
+GBT_TICK_CODE static void gbt_lz77_continue(uint32_t max_bytes)
+{
+    if (gbt.lz77_decoding == NULL)
+        return;
+
+    uint32_t buffer = gbt.lz77_current ^ 1;
+    uint8_t *dst = &gbt.lz77_buffer[buffer][0];
+
+    const uint8_t *src = gbt.lz77_src;
+    uint32_t written = gbt.lz77_written;
+    uint32_t flags = gbt.lz77_flags;
+    uint32_t flags_left = gbt.lz77_flags_left;
+    uint32_t copy_left = gbt.lz77_copy_left;
+    uint32_t copy_disp = gbt.lz77_copy_disp;
+
+    uint32_t end = written + max_bytes;
+    if (end > gbt.lz77_size)
+        end = gbt.lz77_size;
+
+    while (written < end)
+    {
+        if (copy_left > 0)
         {
-            // Disable channel and set bank 1 as writable
-            REG_SOUND3CNT_L = SOUND3CNT_L_DISABLE | SOUND3CNT_L_BANK_SET(0);
+            dst[written] = dst[written - copy_disp];
+            written++;
+            copy_left--;
+            continue;
+        }
 
-            for (int i = 0; i < 16; i += 2)
-            {
-                uint16_t wave_lo = *wave++;
-                uint16_t wave_hi = *wave++;
-                REG_WAVE_RAM[i / 2] = wave_lo | (wave_hi << 8);
-            }
+        if (flags_left == 0)
+        {
+            flags = *src++;
+            flags_left = 8;
+        }
 
-            // Use the 64 samples mode
-            REG_SOUND3CNT_L = SOUND3CNT_L_SIZE_64 | SOUND3CNT_L_ENABLE;
+        if (flags & 0x80)
+        {
+            copy_left = (src[0] >> 4) + 3;
+            copy_disp = (((src[0] & 0xF) << 8) | src[1]) + 1;
+            src += 2;
         }
         else
         {
-            // Set bank 0 as active and use the 32 samples mode
-            REG_SOUND3CNT_L = SOUND3CNT_L_SIZE_32 | SOUND3CNT_L_BANK_SET(0) |
-                            SOUND3CNT_L_ENABLE;
+            dst[written++] = *src++;
         }
 
+        flags <<= 1;
+        flags_left--;
+    }
 
-        // Done
-        gbt.ch3.loaded_instrument = instr;
+    if (written == gbt.lz77_size)
+    {
+        gbt.lz77_pattern[buffer] = gbt.lz77_decoding;
+        gbt.lz77_decoding = NULL;
+        gbt.lz77_needed = 0;
+        return;
     }
 
-    REG_SOUND3CNT_H = gbt.ch3.vol;
-    REG_SOUND3CNT_X = SOUND3CNT_X_RESTART | gbt.ch3.freq;
+    gbt.lz77_src = src;
+    gbt.lz77_written = written;
+    gbt.lz77_flags = flags;
+    gbt.lz77_flags_left = flags_left;
+    gbt.lz77_copy_left = copy_left;
+    gbt.lz77_copy_disp = copy_disp;
 }
 
-static void channel3_silence(void)
+// Starts decompressing a pattern that is needed for the next row, unless it has
+// already been decompressed. It is decompressed in the ticks left until then.
+GBT_TICK_CODE static void gbt_lz77_prefetch(const uint8_t *pattern)
 {
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_3_ENABLE_RIGHT | SOUNDCNT_L_PSG_3_ENABLE_LEFT);
+    if ((pattern == gbt.lz77_pattern[0]) || (pattern == gbt.lz77_pattern[1]))
+        return;
+
+    if (gbt.lz77_decoding != pattern)
+        gbt_lz77_start(pattern);
 
-    REG_SOUND3CNT_X = SOUND3CNT_X_RESTART;
-    REG_SOUND3CNT_H = SOUND3CNT_H_VOLUME_0;
-    REG_SOUND3CNT_X = SOUND3CNT_X_RESTART;
+    gbt.lz77_needed = 1;
 }
 
-static void channel4_refresh_registers(void)
+// Returns the number of bytes to decompress in this tick
+GBT_TICK_CODE static uint32_t gbt_lz77_bytes_this_tick(void)
 {
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_4_ENABLE_RIGHT | SOUNDCNT_L_PSG_4_ENABLE_LEFT);
-    // Panning is set to the right values at the end of the row handling
+    if (gbt.lz77_needed == 0)
+        return GBT_LZ77_BYTES_PER_TICK;
 
-    REG_SOUND4CNT_L = gbt.ch4.vol | gbt.ch4.volslide_args; // Volume slide index 2
-    REG_SOUND4CNT_H = SOUND4CNT_H_RESTART | gbt.ch4.instr;
+    // Spread the bytes left over the ticks left until the next row, this one
+    // included.
+    uint32_t ticks_left = 1;
+    if (gbt.ticks_elapsed + 1 < gbt.speed)
+        ticks_left = gbt.speed - gbt.ticks_elapsed;
+
+    uint32_t bytes_left = gbt.lz77_size - gbt.lz77_written;
+
+    return (bytes_left + ticks_left - 1) / ticks_left;
 }
 
-static void channel4_silence(void)
+// Returns a pointer to the decompressed pattern, or NULL if it hasn't been
+// decompressed yet. In that case it starts decompressing it. If the pattern is
+// available, it also starts the decompression of the pattern that comes after
+// it in the song.
+GBT_TICK_CODE static const uint8_t *gbt_lz77_get_pattern(const uint8_t *pattern)
 {
-    REG_SOUNDCNT_L &= ~(SOUNDCNT_L_PSG_4_ENABLE_RIGHT | SOUNDCNT_L_PSG_4_ENABLE_LEFT);
+    uint32_t buffer = gbt.lz77_current;
+
+    if (gbt.lz77_pattern[buffer] != pattern)
+    {
+        buffer ^= 1;
+
+        // The pattern may not have been decompressed after a jump in the song
+        if (gbt.lz77_pattern[buffer] != pattern)
+        {
+            gbt_lz77_prefetch(pattern);
+            return NULL;
+        }
+
+        gbt.lz77_current = buffer;
+    }
+
+    // Start decompressing the next pattern
+
+    const uint8_t *next = gbt.pattern_array_ptr[gbt.current_order + 1];
+    if ((next == NULL) && gbt.loop_enabled)
+        next = gbt.pattern_array_ptr[0];
+
+    if ((next != NULL) && (next != gbt.lz77_pattern[buffer]) &&
+        (next != gbt.lz77_pattern[buffer ^ 1]) && (next != gbt.lz77_decoding))
+    {
+        gbt_lz77_start(next);
+    }
 
-    REG_SOUND4CNT_L = 0; // Set volume to 0
-    REG_SOUND4CNT_H = SOUND4CNT_H_RESTART;
+    return &gbt.lz77_buffer[buffer][0];
 }
 
-// Player routines
-// ===============
+#endif // GBT_SUPPORT_LZ77
 
-static void gbt_refresh_pattern_ptr(void)
+GBT_TICK_CODE static void gbt_refresh_pattern_ptr(void)
 {
     const uint8_t *src_search = gbt.pattern_array_ptr[gbt.current_order];
 
+    gbt.empty_rows_left = 0;
+
+    // Look for the next channel 3 instrument in the new pattern
+    gbt.ch3_lookahead = 1;
+
+#ifdef GBT_SUPPORT_LZ77
+    if (gbt.has_lz77_patterns)
+    {
+        if (src_search != NULL)
+        {
+            src_search = gbt_lz77_get_pattern(src_search);
+            if (src_search == NULL)
+            {
+                // The current row is found when the pattern is available
+                gbt.lz77_wait = 1;
+                gbt.current_row_data_ptr = NULL;
+                return;
+            }
+        }
+        else if (gbt.loop_enabled)
+        {
+            // The song has ended. The first pattern is needed when it loops.
+            gbt_lz77_prefetch(gbt.pattern_array_ptr[0]);
+        }
+    }
+#endif
+
+    if (gbt.has_row_index)
+    {
+        // The pattern starts with a table with the offsets from the start of
+        // the pattern to each row (16 bit, little endian). This way it isn't
+        // needed to parse all the previous rows.
+        if (src_search != NULL)
+        {
+            const uint8_t *index = src_search;
+            uint32_t row = gbt.current_row;
+
+            uint32_t offset = index[row * 2] | (index[row * 2 + 1] << 8);
+            src_search += offset;
+
+            // All rows in a run of empty rows point to the start of the run.
+            // If the requested row is in the middle of a run, look for the
+            // first row of the run to know how many rows are left.
+            if (IS_EMPTY_ROWS(*src_search))
+            {
+                uint32_t first = row;
+                while (first > 0)
+                {
+                    const uint8_t *prev = &index[(first - 1) * 2];
+                    uint32_t prev_offset = prev[0] | (prev[1] << 8);
+                    if (prev_offset != offset)
+                        break;
+                    first--;
+                }
+
+                if (first != row)
+                {
+                    uint32_t count = EMPTY_ROWS_COUNT(*src_search);
+                    gbt.empty_rows_left = count - (row - first);
+                    src_search++;
+                }
+            }
+        }
+
+        gbt.current_row_data_ptr = src_search;
+        return;
+    }
+
     // Seek the requested row
 
     for (int i = 0; i < gbt.current_row; i++)
     {
+        if (IS_EMPTY_ROWS(*src_search))
+        {
+            uint32_t count = EMPTY_ROWS_COUNT(*src_search);
+            src_search++;
+
+            // If the requested row is in the middle of the run, save the
+            // number of rows left.
+            if (i + count > gbt.current_row)
+                gbt.empty_rows_left = i + count - gbt.current_row;
+
+            i += count - 1;
+            continue;
+        }
+
         for (int j = 0; j < 3; j++) // Channels 1-3
         {
             // Note: The volume bit doesn't affect the final size.
@@ -345,10 +870,27 @@ static void gbt_refresh_pattern_ptr(void)
     gbt.current_row_data_ptr = src_search;
 }
 
+// If the current pattern was still being decompressed when the song changed to
+// it, finish it and look for the current row in it.
+GBT_TICK_CODE static void gbt_lz77_wait_pattern(void)
+{
+#ifdef GBT_SUPPORT_LZ77
+    if (gbt.lz77_wait == 0)
+        return;
+
+    gbt.lz77_wait = 0;
+
+    gbt_lz77_continue(LZ77_BUFFER_SIZE);
+    gbt_refresh_pattern_ptr();
+#endif
+}
+
 #define STARTUP_CMD_DONE                0
 #define STARTUP_CMD_SPEED               1
 #define STARTUP_CMD_PANING              2
 #define STARTUP_CMD_CHANNEL3_INSTRUMENT 3
+#define STARTUP_CMD_ROW_INDEX           4
+#define STARTUP_CMD_LZ77                5
 
 #define SAMPLE_64_ENTRIES   BIT(7)
 
@@ -371,18 +913,16 @@ static void gbt_run_startup_commands(const uint8_t *ptr)
         }
         else if (cmd == STARTUP_CMD_PANING) // Initial panning
         {
-            gbt.ch1.pan = *ptr++;
-            gbt.ch2.pan = *ptr++;
-            gbt.ch3.pan = *ptr++;
-            gbt.ch4.pan = *ptr++;
+            for (int ch = 0; ch < GBT_NUM_CHANNELS; ch++)
+                gbt.pan[ch] = *ptr++;
         }
         else if (cmd == STARTUP_CMD_CHANNEL3_INSTRUMENT) // Set channel 3 sample
         {
             uint8_t flags = *ptr++;
             uint8_t index = flags & 0x3F;
-            gbt.ch3.instrument_flags[index] = flags;
+            gbt.ch3_instrument_flags[index] = flags;
 
-            gbt.ch3.instrument[index] = ptr;
+            gbt.ch3_instrument[index] = ptr;
 
             uint32_t len = 32 / 2;
             if (flags & SAMPLE_64_ENTRIES)
@@ -390,6 +930,14 @@ static void gbt_run_startup_commands(const uint8_t *ptr)
 
             ptr += len;
         }
+        else if (cmd == STARTUP_CMD_ROW_INDEX) // Patterns have a row index
+        {
+            gbt.has_row_index = 1;
+        }
+        else if (cmd == STARTUP_CMD_LZ77) // Patterns are compressed
+        {
+            gbt.has_lz77_patterns = 1;
+        }
     }
 }
 
@@ -423,84 +971,112 @@ void gbt_play(const void *song, int speed)
     gbt.previous_row = 0;
     gbt.previous_order = 0;
 
-    gbt_refresh_pattern_ptr();
+    gbt.has_row_index = 0;
+    gbt.has_lz77_patterns = 0;
+
+#ifdef GBT_SUPPORT_LZ77
+    gbt.lz77_pattern[0] = NULL;
+    gbt.lz77_pattern[1] = NULL;
+    gbt.lz77_current = 0;
+    gbt.lz77_decoding = NULL;
+    gbt.lz77_needed = 0;
+    gbt.lz77_wait = 0;
+#endif
 
-    gbt.ch3.loaded_instrument = 0xFF;
+    gbt.ch3_loaded_instrument = 0xFF;
+    gbt.ch3_pending_instrument = 0xFF;
 
-    gbt.event_callback = NULL;
+    // The contents of wave RAM are unknown, but the bank being played can be
+    // read from the hardware.
+    gbt.ch3_bank_instrument[0] = 0xFF;
+    gbt.ch3_bank_instrument[1] = 0xFF;
+    if (REG_SOUND3CNT_L & SOUND3CNT_L_BANK_SET(1))
+        gbt.ch3_playing_bank = 1;
+    else
+        gbt.ch3_playing_bank = 0;
+    gbt.ch3_lookahead = 0;
+
+    gbt.regs_dirty = 0;
 
-    gbt.ch1.pan = 0x11; // L and R
-    gbt.ch2.pan = 0x22;
-    gbt.ch3.pan = 0x44;
-    gbt.ch4.pan = 0x88;
+    gbt.event_callback = NULL;
 
-    gbt.ch1.vol = 0xF000; // 100%
-    gbt.ch2.vol = 0xF000;
-    gbt.ch3.vol = 0x2000;
-    gbt.ch4.vol = 0xF000;
+#ifdef GBT_COUNT_REGISTER_WRITES
+    gbt.reg_writes_last = 0;
+    gbt.reg_writes_max = 0;
+#endif
 
-    gbt.ch1.instr = 0;
-    gbt.ch2.instr = 0;
-    gbt.ch3.instr = 0;
-    gbt.ch4.instr = 0;
+#ifdef GBT_COUNT_CYCLES
+    gbt.cycles_min = UINT32_MAX;
+    gbt.cycles_max = 0;
+    gbt.cycles_total = 0;
+    gbt.cycles_count = 0;
+#endif
 
-    gbt.ch1.freq = 0;
-    gbt.ch2.freq = 0;
-    gbt.ch3.freq = 0;
+    for (int ch = 0; ch < GBT_NUM_CHANNELS; ch++)
+    {
+        gbt.pan[ch] = 0x11 << ch; // L and R
+        gbt.vol[ch] = 0xF000; // 100%
+        gbt.instr[ch] = 0;
+        gbt.freq[ch] = 0;
 
-    gbt.ch1.arpeggio_enabled = 0;
-    gbt.ch2.arpeggio_enabled = 0;
-    gbt.ch3.arpeggio_enabled = 0;
+        gbt.arpeggio_enabled[ch] = 0;
 
-    gbt.ch1.vibrato_enabled = 0;
-    gbt.ch2.vibrato_enabled = 0;
-    gbt.ch3.vibrato_enabled = 0;
+        gbt.vibrato_enabled[ch] = 0;
+        gbt.vibrato_position[ch] = 0;
+        gbt.vibrato_args[ch] = 0;
 
-    gbt.ch1.vibrato_position = 0;
-    gbt.ch2.vibrato_position = 0;
-    gbt.ch3.vibrato_position = 0;
+        gbt.volslide_args[ch] = 0;
 
-    gbt.ch1.vibrato_args = 0;
-    gbt.ch2.vibrato_args = 0;
-    gbt.ch3.vibrato_args = 0;
+        gbt.cut_note_tick[ch] = 0xFF;
+    }
 
-    gbt.ch1.volslide_args = 0;
-    gbt.ch2.volslide_args = 0;
-    gbt.ch4.volslide_args = 0;
+    for (int ch = 0; ch <= CH3; ch++)
+        gbt.vibrato_freq_depth[ch] = 0xFF;
 
-    gbt.ch1.cut_note_tick = 0xFF;
-    gbt.ch2.cut_note_tick = 0xFF;
-    gbt.ch3.cut_note_tick = 0xFF;
-    gbt.ch4.cut_note_tick = 0xFF;
+    gbt.vol[CH3] = 0x2000; // 100%
 
     gbt.jump_requested = 0;
 
     // Default channel 3 instruments
 
     for (int i = 0; i < 8; i++)
-        gbt.ch3.instrument_flags[i] = 0;
+        gbt.ch3_instrument_flags[i] = 0;
 
-    gbt.ch3.instrument[0] = &gbt_default_wave_0[0];
-    gbt.ch3.instrument[1] = &gbt_default_wave_1[0];
-    gbt.ch3.instrument[2] = &gbt_default_wave_2[0];
-    gbt.ch3.instrument[3] = &gbt_default_wave_3[0];
-    gbt.ch3.instrument[4] = &gbt_default_wave_4[0];
-    gbt.ch3.instrument[5] = &gbt_default_wave_5[0];
-    gbt.ch3.instrument[6] = &gbt_default_wave_6[0];
-    gbt.ch3.instrument[7] = &gbt_default_wave_7[0];
+    gbt.ch3_instrument[0] = &gbt_default_wave_0[0];
+    gbt.ch3_instrument[1] = &gbt_default_wave_1[0];
+    gbt.ch3_instrument[2] = &gbt_default_wave_2[0];
+    gbt.ch3_instrument[3] = &gbt_default_wave_3[0];
+    gbt.ch3_instrument[4] = &gbt_default_wave_4[0];
+    gbt.ch3_instrument[5] = &gbt_default_wave_5[0];
+    gbt.ch3_instrument[6] = &gbt_default_wave_6[0];
+    gbt.ch3_instrument[7] = &gbt_default_wave_7[0];
 
     // Run startup commands after internal player status has been initialized
 
     gbt_run_startup_commands(gbt.startup_cmds_ptr);
 
+#ifndef GBT_SUPPORT_LZ77
+    // Songs with compressed patterns can't be played without LZ77 support
+    if (gbt.has_lz77_patterns)
+    {
+        gbt_stop();
+        return;
+    }
+#endif
+
+    // The startup commands specify the format of the patterns, so this has to
+    // be done after running them.
+
+    gbt_refresh_pattern_ptr();
+
     // Initialize hardware registers
 
-    REG_SOUNDCNT_X = SOUNDCNT_X_MASTER_ENABLE;
+    GBT_REG_WRITE(REG_SOUNDCNT_X, SOUNDCNT_X_MASTER_ENABLE);
 
     // Silence all PSG channels controlled by GBT Player
     uint16_t enabled_ch_mask = GBT_ENABLE_CH_ALL & ~gbt.channels_disabled;
     enabled_ch_mask = (enabled_ch_mask << 8 | enabled_ch_mask << 12);
-    REG_SOUNDCNT_L = REG_SOUNDCNT_L & ~enabled_ch_mask;
+    GBT_REG_WRITE(REG_SOUNDCNT_L, REG_SOUNDCNT_L & ~enabled_ch_mask);
 
     // Don't enable all channels. Maybe the user has disabled a channel before
     // the song playback starts. This variable is set to 0 when the program
@@ -510,14 +1086,13 @@ void gbt_play(const void *song, int speed)
     // gbt.channels_disabled = 0;
     //
     // Only silence channels that are owned by GBT Player.
-    if ((gbt.channels_disabled & GBT_ENABLE_CH1) == 0)
-        channel1_silence();
-    if ((gbt.channels_disabled & GBT_ENABLE_CH2) == 0)
-        channel2_silence();
-    if ((gbt.channels_disabled & GBT_ENABLE_CH3) == 0)
-        channel3_silence();
-    if ((gbt.channels_disabled & GBT_ENABLE_CH4) == 0)
-        channel4_silence();
+    for (int ch = 0; ch < GBT_NUM_CHANNELS; ch++)
+    {
+        if ((gbt.channels_disabled & BIT(ch)) == 0)
+            gbt_channel_silence(ch);
+    }
+
+    gbt_flush_channel_registers();
 
     gbt_volume(GBT_VOLUME_MAX, GBT_VOLUME_MAX);
 
@@ -573,6 +1148,13 @@ int gbt_is_playing(void)
 
 void gbt_pause(int play)
 {
+#ifndef GBT_SUPPORT_LZ77
+    // gbt_play() doesn't start songs with compressed patterns in this build,
+    // so they can't be resumed either.
+    if (play && gbt.has_lz77_patterns)
+        return;
+#endif
+
     gbt.playing = play;
 
     uint16_t mask =
@@ -584,12 +1166,13 @@ void gbt_pause(int play)
     if (play)
     {
         // Unmute sound if playback is resumed
-        uint16_t new_pan = gbt.ch1.pan | gbt.ch2.pan | gbt.ch3.pan | gbt.ch4.pan;
-        REG_SOUNDCNT_L = (REG_SOUNDCNT_L & ~mask) | (new_pan << 8);
+        uint16_t new_pan = gbt.pan[CH1] | gbt.pan[CH2] |
+                           gbt.pan[CH3] | gbt.pan[CH4];
+        GBT_REG_WRITE(REG_SOUNDCNT_L, (REG_SOUNDCNT_L & ~mask) | (new_pan << 8));
     }
     else
     {
-        REG_SOUNDCNT_L &= ~mask;
+        GBT_REG_WRITE(REG_SOUNDCNT_L, REG_SOUNDCNT_L & ~mask);
     }
 }
 
@@ -605,7 +1188,7 @@ void gbt_stop(void)
     // Silence all PSG channels controlled by GBT Player
     uint16_t enabled_ch_mask = GBT_ENABLE_CH_ALL & ~gbt.channels_disabled;
     enabled_ch_mask = (enabled_ch_mask << 8 | enabled_ch_mask << 12);
-    REG_SOUNDCNT_L = REG_SOUNDCNT_L & ~enabled_ch_mask;
+    GBT_REG_WRITE(REG_SOUNDCNT_L, REG_SOUNDCNT_L & ~enabled_ch_mask);
 
     // Don't do this! The sound hardware should be left on in case there is
     // something else using it.
@@ -617,7 +1200,7 @@ void gbt_enable_channels(int flags)
     gbt.channels_disabled = GBT_ENABLE_CH_ALL & ~flags;
 }
 
-static uint16_t gbt_get_freq_from_index(int index)
+GBT_TICK_CODE static uint16_t gbt_get_freq_from_index(int index)
 {
     const uint16_t gbt_frequencies[] = {
         44,  156,  262,  363,  457,  547,  631,  710,  786,  854,  923,  986,
@@ -631,627 +1214,302 @@ static uint16_t gbt_get_freq_from_index(int index)
     return gbt_frequencies[index];
 }
 
-static int gbt_ch1234_nop(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_nop(uint32_t ch, uint32_t args)
 {
+    (void)ch;
     (void)args;
     return 0;
 }
 
-static int gbt_ch1234_speed(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_pan(uint32_t ch, uint32_t args)
 {
-    gbt.speed = args;
-    gbt.ticks_elapsed = 0;
-    return 0;
+    gbt.pan[ch] = args & (0x11 << ch);
+    return 0; // Panning is always updated
 }
 
-static int gbt_ch1234_jump_pattern(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_arpeggio(uint32_t ch, uint32_t args)
 {
-    gbt.jump_requested = 1;
-    gbt.jump_target_row = 0;
-    gbt.jump_target_order = args;
+    // The frequencies are calculated here so that gbt_update() only needs to
+    // read them from the array.
+    uint8_t index = gbt.note_index[ch];
+    gbt.arpeggio_freq[ch][0] = gbt_get_freq_from_index(index);
+    index = gbt.note_index[ch] + ((args >> 4) & 0xF);
+    gbt.arpeggio_freq[ch][1] = gbt_get_freq_from_index(index);
+    index = gbt.note_index[ch] + (args & 0xF);
+    gbt.arpeggio_freq[ch][2] = gbt_get_freq_from_index(index);
+
+    gbt.arpeggio_enabled[ch] = 1;
+    gbt.arpeggio_tick[ch] = 1;
 
-    return 0;
+    return 1;
 }
 
-static int gbt_ch1234_jump_position(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_cut_note(uint32_t ch, uint32_t args)
 {
-    gbt.jump_requested = 1;
-    gbt.jump_target_row = args;
-    gbt.jump_target_order = gbt.current_order + 1;
-
+    gbt.cut_note_tick[ch] = args;
     return 0;
 }
 
-static int gbt_ch1234_event(uint32_t args)
+GBT_TICK_CODE static void gbt_channel_prepare_vibrato(uint32_t ch)
 {
-    if (gbt.event_callback)
-        gbt.event_callback(args, gbt.current_order, gbt.current_row);
+    // Calculate the frequencies for all the positions of the vibrato. This is
+    // only needed if the depth or the base frequency have changed since the
+    // last time, not when a row continues the vibrato of the previous row.
 
-    return 0;
-}
+    uint32_t depth = gbt.vibrato_args[ch] & 0xF;
+    uint32_t base_freq = gbt.base_freq[ch];
 
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
+    if ((gbt.vibrato_freq_depth[ch] == depth) &&
+        (gbt.vibrato_freq_base[ch] == base_freq))
+        return;
 
-#define HAS_VOLUME      BIT(4)
-#define HAS_INSTRUMENT  BIT(5)
-#define HAS_EFFECT      BIT(6)
-#define HAS_NOTE        BIT(7)
-#define HAS_KIT         BIT(7)
+    gbt.vibrato_freq_depth[ch] = depth;
+    gbt.vibrato_freq_base[ch] = base_freq;
 
-// -----------------------------------------------------------------------------
-// --------------------------------- Channel 1 ---------------------------------
-// -----------------------------------------------------------------------------
+    for (uint32_t pos = 0; pos < 64; pos++)
+    {
+        int32_t delta = vibrato_sine[pos];
+        delta *= (int32_t)depth;
+        delta >>= 7;
 
-static int gbt_ch1_pan(uint32_t args)
-{
-    gbt.ch1.pan = args & 0x11;
-    return 0; // Panning is always updated
+        int32_t freq = (int32_t)base_freq - delta;
+        if (freq < 0)
+            freq = 0;
+        else if (freq > 0x7FF)
+            freq = 0x7FF;
+        gbt.vibrato_freq[ch][pos] = freq;
+    }
 }
 
-static int gbt_ch1_cut_note(uint32_t args)
-{
-    gbt.ch1.cut_note_tick = args;
-    return 0;
-}
-
-static int gbt_ch1_arpeggio(uint32_t args)
-{
-    uint32_t base_index = gbt.ch1.arpeggio_freq_index[0];
-    gbt.ch1.arpeggio_freq_index[1] = base_index + ((args >> 4) & 0xF);
-    gbt.ch1.arpeggio_freq_index[2] = base_index + (args & 0xF);
-
-    gbt.ch1.arpeggio_enabled = 1;
-    gbt.ch1.arpeggio_tick = 1;
-
-    return 1;
-}
-
-static int gbt_ch1_vibrato(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_vibrato(uint32_t ch, uint32_t args)
 {
     if (args != 0)
     {
-        gbt.ch1.vibrato_position = 0;
-        gbt.ch1.vibrato_args = args;
+        gbt.vibrato_position[ch] = 0;
+        gbt.vibrato_args[ch] = args;
     }
 
-    gbt.ch1.vibrato_enabled = 1;
+    gbt.vibrato_enabled[ch] = 1;
+
+    // The note of the row, if any, has already been handled, so the base
+    // frequency is the one that will be used until the next row.
+    gbt_channel_prepare_vibrato(ch);
 
     return 1;
 }
 
-static int gbt_ch1_volslide(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_volslide(uint32_t ch, uint32_t args)
 {
-    gbt.ch1.volslide_args = args << 8; // Move to the right location
+    gbt.volslide_args[ch] = args << 8; // Move to the right location
     return 1;
 }
 
-static effect_handler gbt_ch1_jump_table[16] = {
-    gbt_ch1_pan,
-    gbt_ch1_arpeggio,
-    gbt_ch1_cut_note,
-    gbt_ch1_vibrato,
-    gbt_ch1_volslide,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_jump_pattern,
-    gbt_ch1234_jump_position,
-    gbt_ch1234_speed,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_event,
-};
-
-// returns 1 if needed to update registers, 0 if not
-static int gbt_channel_1_set_effect(uint32_t effect, uint8_t data)
+GBT_TICK_CODE static int gbt_effect_jump_pattern(uint32_t ch, uint32_t args)
 {
-    return gbt_ch1_jump_table[effect](data);
-}
+    (void)ch;
 
-static const uint8_t *gbt_channel_1_handle(const uint8_t *data)
-{
-    // Calculate pointer to next channel
-    // Note: The volume bit doesn't affect the final size.
-    const uint8_t sizes[8] = { 1, 2, 3, 3, 2, 3, 4, 4 };
-    uint8_t bits = (*data) >> 5;
-    const uint8_t *next = data + sizes[bits];
-
-    // If the channel is disabled, exit
-    if (gbt.channels_disabled & GBT_ENABLE_CH1)
-    {
-        return next;
-    }
-
-    uint8_t header = *data++;
-
-    int has_volume = header & HAS_VOLUME;
-    int has_instrument = header & HAS_INSTRUMENT;
-    int has_effect = header & HAS_EFFECT;
-    int has_note = header & HAS_NOTE;
-
-    int has_to_update_registers = 0;
-    int note_cut = 0;
-
-    if (has_volume)
-    {
-        gbt.ch1.vol = ((uint16_t)(header & 0xF)) << 12;
-        has_to_update_registers = 1;
-    }
-
-    if (has_note)
-    {
-        uint32_t index = *data++;
-        if (index == 0xFE)
-        {
-            note_cut = 1;
-        }
-        else
-        {
-            gbt.ch1.arpeggio_freq_index[0] = index;
-            gbt.ch1.base_freq = gbt_get_freq_from_index(index);
-            gbt.ch1.freq = gbt.ch1.base_freq;
-            has_to_update_registers = 1;
-        }
-    }
-
-    if (has_instrument)
-    {
-        gbt.ch1.instr = (*data & 0x30) << 2;
-        has_to_update_registers = 1;
-    }
-
-    if (has_effect)
-    {
-        uint8_t effect = (*data++) & 0x0F;
-        uint8_t args = *data;
-        has_to_update_registers |= gbt_channel_1_set_effect(effect, args);
-    }
-
-    if (note_cut)
-    {
-        channel1_silence();
-    }
-    else if (has_to_update_registers)
-    {
-        channel1_refresh_registers();
-    }
+    gbt.jump_requested = 1;
+    gbt.jump_target_row = 0;
+    gbt.jump_target_order = args;
 
-    return next;
+    return 0;
 }
 
-static void channel1_update_effects(void)
+GBT_TICK_CODE static int gbt_effect_jump_position(uint32_t ch, uint32_t args)
 {
-    int update_registers = 0;
-
-    // Cut note
-    // --------
-
-    if (gbt.ch1.cut_note_tick == gbt.ticks_elapsed)
-    {
-        gbt.ch1.cut_note_tick = 0xFF; // Disable cut note
-
-        channel1_silence();
-    }
-
-    // Arpeggio
-    // --------
-
-    if (gbt.ch1.arpeggio_enabled)
-    {
-        uint8_t tick = gbt.ch1.arpeggio_tick;
-        if (tick == 2)
-            gbt.ch1.arpeggio_tick = 0;
-        else
-            gbt.ch1.arpeggio_tick = tick + 1;
-
-        uint32_t index = gbt.ch1.arpeggio_freq_index[tick];
-        gbt.ch1.freq = gbt_get_freq_from_index(index);
-
-        update_registers = 1;
-    }
+    (void)ch;
 
-    // Vibrato
-    // -------
-
-    if (gbt.ch1.vibrato_enabled)
-    {
-        gbt.ch1.vibrato_position += (gbt.ch1.vibrato_args >> 4);
-        gbt.ch1.vibrato_position &= 63;
-
-        int32_t pos = gbt.ch1.vibrato_position;
-        int32_t delta = vibrato_sine[pos];
-        delta *= (int32_t)(gbt.ch1.vibrato_args & 0xF);
-        delta >>= 7;
-
-        int32_t freq = (int32_t)gbt.ch1.base_freq - delta;
-        if (freq < 0)
-            freq = 0;
-        else if (freq > 0x7FF)
-            freq = 0x7FF;
-        gbt.ch1.freq = freq;
-
-        update_registers = 1;
-    }
-
-    // Update channel registers if needed
-    // ----------------------------------
-
-    if (update_registers)
-        channel1_refresh_registers();
-}
-
-// -----------------------------------------------------------------------------
-// --------------------------------- Channel 2 ---------------------------------
-// -----------------------------------------------------------------------------
-
-static int gbt_ch2_pan(uint32_t args)
-{
-    gbt.ch2.pan = args & 0x22;
-    return 0; // Panning is always updated
-}
+    gbt.jump_requested = 1;
+    gbt.jump_target_row = args;
+    gbt.jump_target_order = gbt.current_order + 1;
 
-static int gbt_ch2_cut_note(uint32_t args)
-{
-    gbt.ch2.cut_note_tick = args;
     return 0;
 }
 
-static int gbt_ch2_arpeggio(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_speed(uint32_t ch, uint32_t args)
 {
-    uint32_t base_index = gbt.ch2.arpeggio_freq_index[0];
-    gbt.ch2.arpeggio_freq_index[1] = base_index + ((args >> 4) & 0xF);
-    gbt.ch2.arpeggio_freq_index[2] = base_index + (args & 0xF);
-
-    gbt.ch2.arpeggio_enabled = 1;
-    gbt.ch2.arpeggio_tick = 1;
+    (void)ch;
 
-    return 1;
+    gbt.speed = args;
+    gbt.ticks_elapsed = 0;
+    return 0;
 }
 
-static int gbt_ch2_vibrato(uint32_t args)
+GBT_TICK_CODE static int gbt_effect_event(uint32_t ch, uint32_t args)
 {
-    if (args != 0)
-    {
-        gbt.ch2.vibrato_position = 0;
-        gbt.ch2.vibrato_args = args;
-    }
-
-    gbt.ch2.vibrato_enabled = 1;
+    (void)ch;
 
-    return 1;
-}
+    if (gbt.event_callback)
+        gbt.event_callback(args, gbt.current_order, gbt.current_row);
 
-static int gbt_ch2_volslide(uint32_t args)
-{
-    gbt.ch2.volslide_args = args << 8; // Move to the right location
-    return 1;
+    return 0;
 }
 
-static effect_handler gbt_ch2_jump_table[16] = {
-    gbt_ch2_pan,
-    gbt_ch2_arpeggio,
-    gbt_ch2_cut_note,
-    gbt_ch2_vibrato,
-    gbt_ch2_volslide,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_jump_pattern,
-    gbt_ch1234_jump_position,
-    gbt_ch1234_speed,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_event,
+static const effect_handler gbt_effect_jump_table[16] = {
+    [EFFECT_PAN] = gbt_effect_pan,
+    [EFFECT_ARPEGGIO] = gbt_effect_arpeggio,
+    [EFFECT_NOTE_CUT] = gbt_effect_cut_note,
+    [EFFECT_VIBRATO] = gbt_effect_vibrato,
+    [EFFECT_VOLUME_SLIDE] = gbt_effect_volslide,
+    [5] = gbt_effect_nop,
+    [6] = gbt_effect_nop,
+    [7] = gbt_effect_nop,
+    [EFFECT_PATTERN_JUMP] = gbt_effect_jump_pattern,
+    [EFFECT_BREAK_SET_STEP] = gbt_effect_jump_position,
+    [EFFECT_SPEED] = gbt_effect_speed,
+    [11] = gbt_effect_nop,
+    [12] = gbt_effect_nop,
+    [13] = gbt_effect_nop,
+    [14] = gbt_effect_nop,
+    [EFFECT_EVENT] = gbt_effect_event,
 };
 
 // returns 1 if needed to update registers, 0 if not
-static int gbt_channel_2_set_effect(uint32_t effect, uint8_t data)
+GBT_TICK_CODE static int gbt_channel_set_effect(uint32_t ch, uint32_t effect,
+                                              uint32_t args)
 {
-    return gbt_ch2_jump_table[effect](data);
+    // Effects not supported by a channel are ignored
+    if ((gbt_channel_info[ch].effects & BIT(effect)) == 0)
+        return 0;
+
+    return gbt_effect_jump_table[effect](ch, args);
 }
 
-static const uint8_t *gbt_channel_2_handle(const uint8_t *data)
-{
-    // Calculate pointer to next channel
-    // Note: The volume bit doesn't affect the final size.
-    const uint8_t sizes[8] = { 1, 2, 3, 3, 2, 3, 4, 4 };
-    uint8_t bits = (*data) >> 5;
-    const uint8_t *next = data + sizes[bits];
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
 
-    // If the channel is disabled, exit
-    if (gbt.channels_disabled & GBT_ENABLE_CH2)
-    {
-        return next;
-    }
+#define HAS_VOLUME      BIT(4)
+#define HAS_INSTRUMENT  BIT(5) // Never used in channel 4
+#define HAS_EFFECT      BIT(6)
+#define HAS_NOTE        BIT(7)
+#define HAS_KIT         BIT(7) // Same as HAS_NOTE, used in channel 4
 
-    uint8_t header = *data++;
+GBT_TICK_CODE static void gbt_channel_handle_row(uint32_t ch, uint32_t header,
+                                                 uint32_t note, uint32_t effect,
+                                                 uint32_t args)
+{
+    // Nothing to do if the row is empty
+    if ((header & 0xF0) == 0)
+        return;
 
-    int has_volume = header & HAS_VOLUME;
-    int has_instrument = header & HAS_INSTRUMENT;
-    int has_effect = header & HAS_EFFECT;
-    int has_note = header & HAS_NOTE;
+    const gbt_channel_info_t *info = &gbt_channel_info[ch];
 
     int has_to_update_registers = 0;
     int note_cut = 0;
 
-    if (has_volume)
+    if (header & HAS_VOLUME)
     {
-        gbt.ch2.vol = ((uint16_t)(header & 0xF)) << 12;
+        gbt.vol[ch] = (header & info->vol_mask) << info->vol_shift;
         has_to_update_registers = 1;
     }
 
-    if (has_note)
+    if (header & HAS_NOTE)
     {
-        uint32_t index = *data++;
-        if (index == 0xFE)
+        if (note == 0xFE)
         {
             note_cut = 1;
         }
+        else if (ch == CH4)
+        {
+            gbt.instr[CH4] = gbt_noise[note & 0x0F];
+            has_to_update_registers = 1;
+        }
         else
         {
-            gbt.ch2.arpeggio_freq_index[0] = index;
-            gbt.ch2.base_freq = gbt_get_freq_from_index(index);
-            gbt.ch2.freq = gbt.ch2.base_freq;
+            gbt.note_index[ch] = note;
+            gbt.base_freq[ch] = gbt_get_freq_from_index(note);
+            gbt.freq[ch] = gbt.base_freq[ch];
             has_to_update_registers = 1;
         }
     }
 
-    if (has_instrument)
+    if (header & HAS_INSTRUMENT)
     {
-        gbt.ch2.instr = (*data & 0x30) << 2;
+        gbt.instr[ch] = ((effect >> 4) & info->instr_mask) << info->instr_shift;
         has_to_update_registers = 1;
     }
 
-    if (has_effect)
+    if (header & HAS_EFFECT)
     {
-        uint8_t effect = (*data++) & 0x0F;
-        uint8_t args = *data;
-        has_to_update_registers |= gbt_channel_2_set_effect(effect, args);
+        has_to_update_registers |=
+                gbt_channel_set_effect(ch, effect & 0x0F, args);
     }
 
     if (note_cut)
     {
-        channel2_silence();
+        gbt_channel_silence(ch);
     }
     else if (has_to_update_registers)
     {
-        channel2_refresh_registers();
-    }
-
-    return next;
-}
-
-static void channel2_update_effects(void)
-{
-    int update_registers = 0;
-
-    // Cut note
-    // --------
-
-    if (gbt.ch2.cut_note_tick == gbt.ticks_elapsed)
-    {
-        gbt.ch2.cut_note_tick = 0xFF; // Disable cut note
-
-        channel2_silence();
-    }
-
-    // Arpeggio
-    // --------
-
-    if (gbt.ch2.arpeggio_enabled)
-    {
-        uint8_t tick = gbt.ch2.arpeggio_tick;
-        if (tick == 2)
-            gbt.ch2.arpeggio_tick = 0;
-        else
-            gbt.ch2.arpeggio_tick = tick + 1;
-
-        uint32_t index = gbt.ch2.arpeggio_freq_index[tick];
-        gbt.ch2.freq = gbt_get_freq_from_index(index);
-
-        update_registers = 1;
-    }
-
-    // Vibrato
-    // -------
-
-    if (gbt.ch2.vibrato_enabled)
-    {
-        gbt.ch2.vibrato_position += (gbt.ch2.vibrato_args >> 4);
-        gbt.ch2.vibrato_position &= 63;
-
-        int32_t pos = gbt.ch2.vibrato_position;
-        int32_t delta = vibrato_sine[pos];
-        delta *= (int32_t)(gbt.ch2.vibrato_args & 0xF);
-        delta >>= 7;
-
-        int32_t freq = (int32_t)gbt.ch2.base_freq - delta;
-        if (freq < 0)
-            freq = 0;
-        else if (freq > 0x7FF)
-            freq = 0x7FF;
-        gbt.ch2.freq = freq;
-
-        update_registers = 1;
+        gbt_channel_refresh_registers(ch);
     }
-
-    // Update channel registers if needed
-    // ----------------------------------
-
-    if (update_registers)
-        channel2_refresh_registers();
-}
-
-// -----------------------------------------------------------------------------
-// --------------------------------- Channel 3 ---------------------------------
-// -----------------------------------------------------------------------------
-
-static int gbt_ch3_pan(uint32_t args)
-{
-    gbt.ch3.pan = args & 0x44;
-    return 0; // Panning is always updated
 }
 
-static int gbt_ch3_cut_note(uint32_t args)
-{
-    gbt.ch3.cut_note_tick = args;
-    return 0;
-}
-
-static int gbt_ch3_arpeggio(uint32_t args)
-{
-    uint32_t base_index = gbt.ch3.arpeggio_freq_index[0];
-    gbt.ch3.arpeggio_freq_index[1] = base_index + ((args >> 4) & 0xF);
-    gbt.ch3.arpeggio_freq_index[2] = base_index + (args & 0xF);
-
-    gbt.ch3.arpeggio_enabled = 1;
-    gbt.ch3.arpeggio_tick = 1;
-
-    return 1;
-}
-
-static int gbt_ch3_vibrato(uint32_t args)
-{
-    if (args != 0)
-    {
-        gbt.ch3.vibrato_position = 0;
-        gbt.ch3.vibrato_args = args;
-    }
-
-    gbt.ch3.vibrato_enabled = 1;
-
-    return 1;
-}
-
-static effect_handler gbt_ch3_jump_table[16] = {
-    gbt_ch3_pan,
-    gbt_ch3_arpeggio,
-    gbt_ch3_cut_note,
-    gbt_ch3_vibrato,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_jump_pattern,
-    gbt_ch1234_jump_position,
-    gbt_ch1234_speed,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_event,
-};
-
-// returns 1 if needed to update registers, 0 if not
-static int gbt_channel_3_set_effect(uint32_t effect, uint8_t data)
-{
-    return gbt_ch3_jump_table[effect](data);
-}
-
-static const uint8_t *gbt_channel_3_handle(const uint8_t *data)
+GBT_TICK_CODE static const uint8_t *gbt_channel_handle(uint32_t ch,
+                                                       const uint8_t *data)
 {
     // Calculate pointer to next channel
-    // Note: The volume bit doesn't affect the final size.
+    // Note: The volume bit doesn't affect the final size. Channel 4 doesn't
+    // have instruments, so the table works for it as well.
     const uint8_t sizes[8] = { 1, 2, 3, 3, 2, 3, 4, 4 };
     uint8_t bits = (*data) >> 5;
     const uint8_t *next = data + sizes[bits];
 
     // If the channel is disabled, exit
-    if (gbt.channels_disabled & GBT_ENABLE_CH3)
+    if (gbt.channels_disabled & BIT(ch))
     {
         return next;
     }
 
-    uint8_t header = *data++;
-
-    int has_volume = header & HAS_VOLUME;
-    int has_instrument = header & HAS_INSTRUMENT;
-    int has_effect = header & HAS_EFFECT;
-    int has_note = header & HAS_NOTE;
-
-    int has_to_update_registers = 0;
-    int note_cut = 0;
+    uint32_t header = *data++;
+    uint32_t note = 0;
+    uint32_t effect = 0;
+    uint32_t args = 0;
 
-    if (has_volume)
-    {
-        gbt.ch3.vol = ((uint16_t)(header & 0x7)) << 13;
-        has_to_update_registers = 1;
-    }
-
-    if (has_note)
-    {
-        uint32_t index = *data++;
-        if (index == 0xFE)
-        {
-            note_cut = 1;
-        }
-        else
-        {
-            gbt.ch3.arpeggio_freq_index[0] = index;
-            gbt.ch3.base_freq = gbt_get_freq_from_index(index);
-            gbt.ch3.freq = gbt.ch3.base_freq;
-            has_to_update_registers = 1;
-        }
-    }
+    if (header & HAS_NOTE)
+        note = *data++;
 
-    if (has_instrument)
+    // The instrument and effect number share the same byte
+    if (header & (HAS_INSTRUMENT | HAS_EFFECT))
     {
-        gbt.ch3.instr = (*data & 0x70) >> 4;
-        has_to_update_registers = 1;
-    }
+        effect = *data++;
 
-    if (has_effect)
-    {
-        uint8_t effect = (*data++) & 0x0F;
-        uint8_t args = *data;
-        has_to_update_registers |= gbt_channel_3_set_effect(effect, args);
+        if (header & HAS_EFFECT)
+            args = *data;
     }
 
-    if (note_cut)
-    {
-        channel3_silence();
-    }
-    else if (has_to_update_registers)
-    {
-        channel3_refresh_registers();
-    }
+    gbt_channel_handle_row(ch, header, note, effect, args);
 
     return next;
 }
 
-static void channel3_update_effects(void)
+GBT_TICK_CODE static void gbt_channel_update_effects(uint32_t ch)
 {
     int update_registers = 0;
 
     // Cut note
     // --------
 
-    if (gbt.ch3.cut_note_tick == gbt.ticks_elapsed)
+    if (gbt.cut_note_tick[ch] == gbt.ticks_elapsed)
     {
-        gbt.ch3.cut_note_tick = 0xFF; // Disable cut note
+        gbt.cut_note_tick[ch] = 0xFF; // Disable cut note
 
-        channel3_silence();
+        gbt_channel_silence(ch);
     }
 
     // Arpeggio
     // --------
 
-    if (gbt.ch3.arpeggio_enabled)
+    if (gbt.arpeggio_enabled[ch])
     {
-        uint8_t tick = gbt.ch3.arpeggio_tick;
+        uint8_t tick = gbt.arpeggio_tick[ch];
         if (tick == 2)
-            gbt.ch3.arpeggio_tick = 0;
+            gbt.arpeggio_tick[ch] = 0;
         else
-            gbt.ch3.arpeggio_tick = tick + 1;
+            gbt.arpeggio_tick[ch] = tick + 1;
 
-        uint32_t index = gbt.ch3.arpeggio_freq_index[tick];
-        gbt.ch3.freq = gbt_get_freq_from_index(index);
+        gbt.freq[ch] = gbt.arpeggio_freq[ch][tick];
 
         update_registers = 1;
     }
@@ -1259,22 +1517,13 @@ static void channel3_update_effects(void)
     // Vibrato
     // -------
 
-    if (gbt.ch3.vibrato_enabled)
+    if (gbt.vibrato_enabled[ch])
     {
-        gbt.ch3.vibrato_position += (gbt.ch3.vibrato_args >> 4);
-        gbt.ch3.vibrato_position &= 63;
+        uint32_t pos = gbt.vibrato_position[ch] + (gbt.vibrato_args[ch] >> 4);
+        pos &= 63;
+        gbt.vibrato_position[ch] = pos;
 
-        int32_t pos = gbt.ch3.vibrato_position;
-        int32_t delta = vibrato_sine[pos];
-        delta *= (int32_t)(gbt.ch3.vibrato_args & 0xF);
-        delta >>= 7;
-
-        int32_t freq = (int32_t)gbt.ch3.base_freq - delta;
-        if (freq < 0)
-            freq = 0;
-        else if (freq > 0x7FF)
-            freq = 0x7FF;
-        gbt.ch3.freq = freq;
+        gbt.freq[ch] = gbt.vibrato_freq[ch][pos];
 
         update_registers = 1;
     }
@@ -1283,187 +1532,133 @@ static void channel3_update_effects(void)
     // ----------------------------------
 
     if (update_registers)
-        channel3_refresh_registers();
+        gbt_channel_refresh_registers(ch);
 }
 
-// -----------------------------------------------------------------------------
-// --------------------------------- Channel 4 ---------------------------------
-// -----------------------------------------------------------------------------
-
-static int gbt_ch4_pan(uint32_t args)
+GBT_TICK_CODE static void gbt_update_effects_internal(void)
 {
-    gbt.ch4.pan = args & 0x88;
-    return 0; // Panning is always updated
+    for (uint32_t ch = 0; ch < GBT_NUM_CHANNELS; ch++)
+        gbt_channel_update_effects(ch);
 }
 
-static int gbt_ch4_cut_note(uint32_t args)
+GBT_TICK_CODE static void gbt_update_refresh_panning(uint32_t refreshed_channels)
 {
-    gbt.ch4.cut_note_tick = args;
-    return 0;
-}
+    // This function needs to take care of three things:
+    //
+    // - Panning can be modified by effects in the song (saved in gbt.pan).
+    //
+    // - The global volume of PSG channels can't reach 0, the only way to make
+    //   it reach 0 is by setting all the left/right enable bits to 0. This is
+    //   what gbt_volume() does.
+    //
+    // - Channels disabled by gbt_enable_channels() aren't owned by GBT Player,
+    //   so their bits need to be preserved in case the user is modifying them
+    //   manually.
 
-static int gbt_ch4_volslide(uint32_t args)
-{
-    // Volume slide index 2
-    gbt.ch4.volslide_args = args << 8; // Move to the right location
-    return 1;
-}
+    uint16_t enabled_ch_mask = GBT_ENABLE_CH_ALL & ~gbt.channels_disabled;
+    enabled_ch_mask = (enabled_ch_mask << 8 | enabled_ch_mask << 12);
 
-static effect_handler gbt_ch4_jump_table[16] = {
-    gbt_ch4_pan,
-    gbt_ch1234_nop,
-    gbt_ch4_cut_note,
-    gbt_ch1234_nop,
-    gbt_ch4_volslide,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_jump_pattern,
-    gbt_ch1234_jump_position,
-    gbt_ch1234_speed,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_nop,
-    gbt_ch1234_event,
-};
+    uint16_t old_pan = REG_SOUNDCNT_L & (0xFF << 8);
 
-// returns 1 if needed to update registers, 0 if not
-static int gbt_channel_4_set_effect(uint32_t effect, uint8_t data)
+    // Channels whose registers have been written during this tick are muted
+    // while it happens. This only makes a difference for channels that have
+    // been disabled while an effect was active.
+    refreshed_channels = refreshed_channels << 8 | refreshed_channels << 12;
+    old_pan &= ~refreshed_channels;
+
+    uint16_t new_pan = gbt.pan[CH1] | gbt.pan[CH2] | gbt.pan[CH3] | gbt.pan[CH4];
+    new_pan = (new_pan << 8) & gbt.pan_volume_mask;
+
+    uint16_t result_pan = (old_pan & ~enabled_ch_mask)
+                        | (new_pan & enabled_ch_mask);
+
+    GBT_REG_WRITE(REG_SOUNDCNT_L, gbt.global_volume | result_pan);
+}
+
+// Writes all the registers modified during this tick
+GBT_TICK_CODE static void gbt_flush_registers(void)
 {
-    return gbt_ch4_jump_table[effect](data);
+    uint32_t refreshed_channels = gbt_flush_channel_registers();
+    gbt_update_refresh_panning(refreshed_channels);
 }
 
-static const uint8_t *gbt_channel_4_handle(const uint8_t *data)
+// Looks for the next channel 3 instrument in the rest of the current pattern
+// and writes it to the bank of wave RAM that isn't being played. When it is
+// needed, only the banks have to be switched.
+GBT_TICK_CODE static void gbt_channel3_lookahead(void)
 {
-    // Calculate pointer to next channel
-    // Note: The volume bit doesn't affect the final size.
-    const uint8_t sizes[4] = { 1, 3, 2, 4 };
-    uint8_t bits = (*data) >> 6;
-    const uint8_t *next = data + sizes[bits];
+    gbt.ch3_lookahead = 0;
 
-    // If the channel is disabled, exit
-    if (gbt.channels_disabled & GBT_ENABLE_CH4)
-    {
-        return next;
-    }
+    // Wave RAM can't be modified if channel 3 is used by the user, or if an
+    // instrument of 64 samples is being played from both banks.
 
-    uint8_t header = *data++;
+    if (gbt.channels_disabled & BIT(CH3))
+        return;
 
-    int has_volume = header & HAS_VOLUME;
-    int has_effect = header & HAS_EFFECT;
-    int has_kit = header & HAS_KIT;
+    uint32_t loaded = gbt.ch3_loaded_instrument;
+    if ((loaded == 0xFF) || (gbt.ch3_instrument_flags[loaded] & BIT(7)))
+        return;
 
-    int has_to_update_registers = 0;
-    int note_cut = 0;
+    const uint8_t *ptr = gbt.current_row_data_ptr;
+    if (ptr == NULL)
+        return;
 
-    if (has_volume)
-    {
-        gbt.ch4.vol = ((uint16_t)(header & 0xF)) << 12;
-        has_to_update_registers = 1;
-    }
+    // The rows of a run of empty rows that hasn't finished can be skipped
+    uint32_t rows = 64 - gbt.current_row - gbt.empty_rows_left;
 
-    if (has_kit)
+    for (uint32_t i = 0; i < rows; i++)
     {
-        uint32_t index = *data++;
-        if (index == 0xFE)
+        if (IS_EMPTY_ROWS(*ptr))
         {
-            note_cut = 1;
+            i += EMPTY_ROWS_COUNT(*ptr) - 1;
+            ptr++;
+            continue;
         }
-        else
-        {
-            index &= 0x0F;
-            gbt.ch4.instr = gbt_noise[index];
-            has_to_update_registers = 1;
-        }
-    }
-
-    if (has_effect)
-    {
-        uint8_t effect = (*data++) & 0x0F;
-        uint8_t args = *data++;
-        has_to_update_registers |= gbt_channel_4_set_effect(effect, args);
-    }
-
-    if (note_cut)
-    {
-        channel4_silence();
-    }
-    else if (has_to_update_registers)
-    {
-        channel4_refresh_registers();
-    }
-
-    return next;
-}
-
-static void channel4_update_effects(void)
-{
-    int update_registers = 0;
-
-    // Cut note
-    // --------
-
-    if (gbt.ch4.cut_note_tick == gbt.ticks_elapsed)
-    {
-        gbt.ch4.cut_note_tick = 0xFF; // Disable cut note
 
-        channel4_silence();
-    }
-
-    // Update channel registers if needed
-    // ----------------------------------
-
-    if (update_registers)
-        channel4_refresh_registers();
-}
+        // Note: The volume bit doesn't affect the final size. Channel 4
+        // doesn't have instruments, so the table works for it as well.
+        const uint8_t sizes[8] = { 1, 2, 3, 3, 2, 3, 4, 4 };
 
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
-// -----------------------------------------------------------------------------
+        ptr += sizes[*ptr >> 5]; // Channel 1
+        ptr += sizes[*ptr >> 5]; // Channel 2
 
-static void gbt_update_effects_internal(void)
-{
-    channel1_update_effects();
-    channel2_update_effects();
-    channel3_update_effects();
-    channel4_update_effects();
-}
+        uint32_t header = ptr[0];
+        uint32_t instr_effect = 0;
+        if (header & HAS_INSTRUMENT)
+            instr_effect = (header & HAS_NOTE) ? ptr[2] : ptr[1];
 
-static void gbt_update_refresh_panning(void)
-{
-    // This function needs to take care of three things:
-    //
-    // - Panning can be modified by effects in the song (saved in gbt.chX.pan).
-    //
-    // - The global volume of PSG channels can't reach 0, the only way to make
-    //   it reach 0 is by setting all the left/right enable bits to 0. This is
-    //   what gbt_volume() does.
-    //
-    // - Channels disabled by gbt_enable_channels() aren't owned by GBT Player,
-    //   so their bits need to be preserved in case the user is modifying them
-    //   manually.
+        ptr += sizes[*ptr >> 5]; // Channel 3
+        ptr += sizes[*ptr >> 5]; // Channel 4
 
-    uint16_t enabled_ch_mask = GBT_ENABLE_CH_ALL & ~gbt.channels_disabled;
-    enabled_ch_mask = (enabled_ch_mask << 8 | enabled_ch_mask << 12);
+        if ((header & HAS_INSTRUMENT) == 0)
+            continue;
 
-    uint16_t old_pan = REG_SOUNDCNT_L & (0xFF << 8);
+        const gbt_channel_info_t *info = &gbt_channel_info[CH3];
+        uint32_t instr = (instr_effect >> 4) & info->instr_mask;
 
-    uint16_t new_pan = gbt.ch1.pan | gbt.ch2.pan | gbt.ch3.pan | gbt.ch4.pan;
-    new_pan = (new_pan << 8) & gbt.pan_volume_mask;
+        if (instr == loaded)
+            continue;
 
-    uint16_t result_pan = (old_pan & ~enabled_ch_mask)
-                        | (new_pan & enabled_ch_mask);
+        // Instruments of 64 samples can't be preloaded
+        if ((gbt.ch3_instrument_flags[instr] & BIT(7)) == 0)
+            channel3_preload_instrument(instr);
 
-    REG_SOUNDCNT_L = gbt.global_volume | result_pan;
+        return;
+    }
 }
 
-void gbt_update(void)
+GBT_TICK_CODE static void gbt_update_internal(void)
 {
     // If not playing, return
     if (gbt.playing == 0)
         return;
 
+#ifdef GBT_SUPPORT_LZ77
+    // Continue decompressing the next pattern (if any)
+
+    gbt_lz77_continue(gbt_lz77_bytes_this_tick());
+#endif
+
     // Handle tick counter
 
     gbt.ticks_elapsed++;
@@ -1471,7 +1666,13 @@ void gbt_update(void)
     {
         // Update effects and exit
         gbt_update_effects_internal();
-        gbt_update_refresh_panning();
+        gbt_flush_registers();
+
+        // Preload the next channel 3 instrument if needed. This is done in
+        // ticks without rows so that it doesn't add to the cost of a row.
+        if (gbt.ch3_lookahead)
+            gbt_channel3_lookahead();
+
         return;
     }
 
@@ -1480,28 +1681,23 @@ void gbt_update(void)
     // Clear tick-based effects
     // ------------------------
 
-    gbt.ch1.arpeggio_enabled = 0; // Disable arpeggio
-    gbt.ch2.arpeggio_enabled = 0;
-    gbt.ch3.arpeggio_enabled = 0;
-
-    gbt.ch1.vibrato_enabled = 0; // Disable vibrato
-    gbt.ch2.vibrato_enabled = 0;
-    gbt.ch3.vibrato_enabled = 0;
-
-    gbt.ch1.volslide_args = 0; // Disable volume slide
-    gbt.ch2.volslide_args = 0;
-    gbt.ch4.volslide_args = 0;
-
-    gbt.ch1.cut_note_tick = 0xFF; // Disable cut note
-    gbt.ch2.cut_note_tick = 0xFF;
-    gbt.ch3.cut_note_tick = 0xFF;
-    gbt.ch4.cut_note_tick = 0xFF;
+    for (uint32_t ch = 0; ch < GBT_NUM_CHANNELS; ch++)
+    {
+        gbt.arpeggio_enabled[ch] = 0; // Disable arpeggio
+        gbt.vibrato_enabled[ch] = 0; // Disable vibrato
+        gbt.volslide_args[ch] = 0; // Disable volume slide
+        gbt.cut_note_tick[ch] = 0xFF; // Disable cut note
+    }
 
     // Update effects
     // --------------
 
     gbt_update_effects_internal();
 
+    // The pattern has been decompressed by now, but the current row hasn't
+    // been found in it yet.
+    gbt_lz77_wait_pattern();
+
     // Check if the song has ended
     // ---------------------------
 
@@ -1514,12 +1710,14 @@ void gbt_update(void)
         {
             // If loop is enabled, jump to pattern 0
             gbt.current_order = 0;
-            gbt_refresh_pattern_ptr();
             gbt_run_startup_commands(gbt.startup_cmds_ptr);
+            gbt_refresh_pattern_ptr();
+            gbt_lz77_wait_pattern();
         }
         else
         {
             // If loop is disabled, stop song
+            gbt_flush_channel_registers();
             gbt_stop();
             return;
         }
@@ -1536,17 +1734,28 @@ void gbt_update(void)
 
     const uint8_t *ptr = gbt.current_row_data_ptr;
 
-    ptr = gbt_channel_1_handle(ptr);
-    ptr = gbt_channel_2_handle(ptr);
-    ptr = gbt_channel_3_handle(ptr);
-    ptr = gbt_channel_4_handle(ptr);
+    if (gbt.empty_rows_left > 0)
+    {
+        // This row is part of a run of empty rows, there is nothing to do
+        gbt.empty_rows_left--;
+    }
+    else if (IS_EMPTY_ROWS(*ptr))
+    {
+        gbt.empty_rows_left = EMPTY_ROWS_COUNT(*ptr) - 1;
+        ptr++;
+    }
+    else
+    {
+        for (uint32_t ch = 0; ch < GBT_NUM_CHANNELS; ch++)
+            ptr = gbt_channel_handle(ch, ptr);
+    }
 
     gbt.current_row_data_ptr = ptr;
 
-    // Handle panning
-    // --------------
+    // Write registers and handle panning
+    // ----------------------------------
 
-    gbt_update_refresh_panning();
+    gbt_flush_registers();
 
     // Increment row
     // -------------
@@ -1572,6 +1781,54 @@ void gbt_update(void)
 
         gbt_refresh_pattern_ptr();
     }
+
+    // If all ticks have rows, preload the next channel 3 instrument now
+    if (gbt.ch3_lookahead && (gbt.speed == 1))
+        gbt_channel3_lookahead();
+}
+
+GBT_TICK_CODE void gbt_update(void)
+{
+#ifdef GBT_COUNT_REGISTER_WRITES
+    gbt.reg_writes = 0;
+#endif
+
+#ifdef GBT_COUNT_CYCLES
+    // Only measure the calls done while the song is playing
+    int measure_cycles = gbt.playing;
+
+    // Timer 2 counts cycles, timer 3 counts overflows of timer 2
+    REG_TM2CNT_H = 0;
+    REG_TM3CNT_H = 0;
+    REG_TM2CNT_L = 0;
+    REG_TM3CNT_L = 0;
+    REG_TM3CNT_H = GBT_TIMER_CASCADE | GBT_TIMER_START;
+    REG_TM2CNT_H = GBT_TIMER_START;
+#endif
+
+    gbt_update_internal();
+
+#ifdef GBT_COUNT_CYCLES
+    REG_TM2CNT_H = 0;
+    uint32_t cycles = REG_TM2CNT_L | ((uint32_t)REG_TM3CNT_L << 16);
+    REG_TM3CNT_H = 0;
+
+    if (measure_cycles)
+    {
+        if (gbt.cycles_min > cycles)
+            gbt.cycles_min = cycles;
+        if (gbt.cycles_max < cycles)
+            gbt.cycles_max = cycles;
+        gbt.cycles_total += cycles;
+        gbt.cycles_count++;
+    }
+#endif
+
+#ifdef GBT_COUNT_REGISTER_WRITES
+    gbt.reg_writes_last = gbt.reg_writes;
+    if (gbt.reg_writes_max < gbt.reg_writes)
+        gbt.reg_writes_max = gbt.reg_writes;
+#endif
 }
 
 void gbt_get_position(int *order, int *row, int *tick)
@@ -1602,14 +1859,17 @@ void gbt_set_position(int order, int row)
         return;
 
     // Silence channels until the next tick
-    if (!(gbt.channels_disabled & GBT_ENABLE_CH1))
-        channel1_silence();
-    if (!(gbt.channels_disabled & GBT_ENABLE_CH2))
-        channel2_silence();
-    if (!(gbt.channels_disabled & GBT_ENABLE_CH3))
-        channel3_silence();
-    if (!(gbt.channels_disabled & GBT_ENABLE_CH4))
-        channel4_silence();
+    uint16_t enabled_ch_mask = GBT_ENABLE_CH_ALL & ~gbt.channels_disabled;
+    enabled_ch_mask = (enabled_ch_mask << 8 | enabled_ch_mask << 12);
+    GBT_REG_WRITE(REG_SOUNDCNT_L, REG_SOUNDCNT_L & ~enabled_ch_mask);
+
+    for (int ch = 0; ch < GBT_NUM_CHANNELS; ch++)
+    {
+        if (!(gbt.channels_disabled & BIT(ch)))
+            gbt_channel_silence(ch);
+    }
+
+    gbt_flush_channel_registers();
 
     // Force refresh as soon as possible, in the next tick
     gbt.ticks_elapsed = gbt.speed - 1;
@@ -1619,3 +1879,39 @@ void gbt_set_position(int order, int row)
 
     gbt_refresh_pattern_ptr();
 }
+
+void gbt_get_register_writes(int *last, int *max)
+{
+#ifdef GBT_COUNT_REGISTER_WRITES
+    if (last)
+        *last = gbt.reg_writes_last;
+    if (max)
+        *max = gbt.reg_writes_max;
+#else
+    if (last)
+        *last = -1;
+    if (max)
+        *max = -1;
+#endif
+}
+
+void gbt_get_update_cycles(int *min, int *max, int *average)
+{
+#ifdef GBT_COUNT_CYCLES
+    uint32_t count = gbt.cycles_count;
+
+    if (min)
+        *min = count ? (int)gbt.cycles_min : 0;
+    if (max)
+        *max = (int)gbt.cycles_max;
+    if (average)
+        *average = count ? (int)(gbt.cycles_total / count) : 0;
+#else
+    if (min)
+        *min = -1;
+    if (max)
+        *max = -1;
+    if (average)
+        *average = -1;
+#endif
+}
@@ -19,6 +19,10 @@
 // Note: This function won't silence any channel that is disabled in GBT Player
 // (any sound effect played by the user will keep playing even when the song
 // starts).
+//
+// Note: Songs converted with LZ77-compressed patterns can only be played if GBT
+// Player is built with GBT_SUPPORT_LZ77 defined. If it isn't defined, this
+// function stops the song that is playing (if any) and doesn't play the new one.
 void gbt_play(const void *song, int speed);
 
 // Pauses or unpauses the song. 0 pauses the song, anything else unpauses it.
@@ -92,4 +96,32 @@ typedef void (*gbt_event_callback)(int event, int order, int row);
 // has to be set whenever a new song starts.
 void gbt_set_event_callback_handler(gbt_event_callback callback);
 
+// Statistics
+// ----------
+
+// If GBT Player is built with GBT_COUNT_REGISTER_WRITES defined, it counts the
+// number of writes to hardware registers done by gbt_update(). This function
+// returns the number of writes done by the last call to gbt_update() and the
+// maximum number of writes done by one call since the song started. It is
+// possible to pass NULL to any argument if you don't need that value. If the
+// counter isn't enabled, both values are -1.
+void gbt_get_register_writes(int *last, int *max);
+
+// If GBT Player is built with GBT_COUNT_CYCLES defined, it measures the number
+// of CPU cycles taken by gbt_update() while a song is playing. This function
+// returns the minimum, maximum and average number of cycles since the song
+// started. It is possible to pass NULL to any argument if you don't need that
+// value. If the counter isn't enabled, all values are -1.
+//
+// Note: Timers 2 and 3 are used for the measurements, so they can't be used by
+// the user while the song is playing. Every call to gbt_update() resets and
+// restarts both timers, and stops them before returning, even if no song is
+// playing. The measurements are only meaningful in the GBA, the SDL2 port
+// doesn't emulate the timing of the CPU.
+//
+// Note: If GBT Player is built with GBT_TICK_IN_IWRAM defined, the code used by
+// gbt_update() is placed in IWRAM and built as ARM code. This counter can be
+// used to compare both builds.
+void gbt_get_update_cycles(int *min, int *max, int *average);
+
 #endif // GBT_PLAYER_H__
@@ -6,6 +6,8 @@
 //
 //     https://github.com/AntonioND/gbt-player
 
+#include <stdio.h>
+
 #include <ugba/ugba.h>
 
 #include "gbt_player.h"
@@ -36,7 +38,35 @@ int main(int argc, char *argv[])
     gbt_play(template, 0);
 
     while (1)
+    {
         SWI_VBlankIntrWait();
 
+        // This example is built with GBT_COUNT_CYCLES and
+        // GBT_COUNT_REGISTER_WRITES, so the player keeps track of how much
+        // work is done by gbt_update(). The cycle counts are only meaningful
+        // on GBA.
+
+        int cycles_min, cycles_max, cycles_average;
+        gbt_get_update_cycles(&cycles_min, &cycles_max, &cycles_average);
+
+        int writes_last, writes_max;
+        gbt_get_register_writes(&writes_last, &writes_max);
+
+        char str[200];
+        snprintf(str, sizeof(str),
+                 "Cycles per update:\n"
+                 "  Min: %d \n"
+                 "  Max: %d \n"
+                 "  Avg: %d \n"
+                 "\n"
+                 "Register writes per update:\n"
+                 "  Last: %d \n"
+                 "  Max: %d ",
+                 cycles_min, cycles_max, cycles_average,
+                 writes_last, writes_max);
+        CON_CursorSet(0, 2);
+        CON_Print(str);
+    }
+
     return 0;
 }
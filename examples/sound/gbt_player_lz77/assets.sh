@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# SPDX-License-Identifier: GPL-3.0-only
+#
+# Copyright (c) 2021-2022, Antonio Niño Díaz
+
+set -e
+
+SCRIPT=`realpath $0`
+IN=`dirname $SCRIPT`
+
+echo ""
+echo "[*] Converting ${IN}..."
+echo ""
+
+# Prepare destination folder
+
+OUT_DIR=built_assets
+rm -rf ${OUT_DIR}
+mkdir ${OUT_DIR}
+
+# Convert music
+
+mkdir ${OUT_DIR}/audio
+
+S3M2GBT=../gbt_player/s3m2gbt.py
+
+# This is the same song as the one of the GBT Player example, but it uses all
+# the options that change the format of the patterns. It must sound the same.
+
+python3 ${S3M2GBT} \
+    --input ../gbt_player/audio/template.s3m \
+    --name template \
+    --output ${OUT_DIR}/audio/template.c \
+    --instruments \
+    --lz77 \
+    --row-index \
+    --skip-empty-rows
+
+# Done!
+
+exit 0
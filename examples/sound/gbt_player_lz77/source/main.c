@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz
+
+// Example of playing music with GBT Player. The song has been converted with
+// all the options of s3m2gbt that change the format of the patterns: they are
+// compressed with LZ77, they have a row index, and runs of empty rows are
+// stored as a single byte. It must sound the same as the GBT Player example,
+// even though it jumps to the next row a few times (check seek_next_row()).
+//
+//     https://github.com/AntonioND/gbt-player
+
+#include <ugba/ugba.h>
+
+#include "gbt_player.h"
+
+extern const uint8_t *template[];
+
+// The song is played at speed 6, so each row lasts 6 ticks
+#define SONG_SPEED          6
+
+// During the first rows of the song, jump to each row right before it is
+// played. Finding a row in the middle of a pattern uses the row index of the
+// pattern, and it needs to handle runs of empty rows. Rows 29 to 31 are a run
+// of empty rows, so jumping to rows 30 and 31 means jumping to the middle of
+// the run.
+//
+// The channels are disabled during the jump so that gbt_set_position() doesn't
+// silence them. This way, the song must sound the same as without the jumps.
+#define SEEK_LAST_ROW       31
+
+static void seek_next_row(void)
+{
+    int order, row, tick;
+    gbt_get_position(&order, &row, &tick);
+
+    // Right after gbt_play() the position is also row 0 and the last tick, but
+    // the next row is row 0. Only jump after row 1 has started.
+    if ((order != 0) || (row < 1) || (row >= SEEK_LAST_ROW))
+        return;
+
+    // Only jump if the next call to gbt_update() starts a new row
+    if (tick != SONG_SPEED - 1)
+        return;
+
+    gbt_enable_channels(0);
+    gbt_set_position(order, row + 1);
+    gbt_enable_channels(GBT_ENABLE_CH_ALL);
+}
+
+// Jump to the end of the last pattern, which hasn't been decompressed yet, so
+// it needs to be decompressed right away. Rows 61 to 63 are a run of empty
+// rows, and the jump goes to the middle of it. This isn't part of the audio
+// that is compared with the reference, but it is still run by the test.
+#define JUMP_FROM_ROW       40
+#define JUMP_TO_ORDER       3
+#define JUMP_TO_ROW         62
+
+static void jump_to_end(void)
+{
+    int order, row, tick;
+    gbt_get_position(&order, &row, &tick);
+
+    if ((order == 0) && (row == JUMP_FROM_ROW) && (tick == SONG_SPEED - 1))
+        gbt_set_position(JUMP_TO_ORDER, JUMP_TO_ROW);
+}
+
+void vbl_handler(void)
+{
+    seek_next_row();
+    jump_to_end();
+
+    gbt_update();
+}
+
+int main(int argc, char *argv[])
+{
+    UGBA_Init(&argc, &argv);
+
+    IRQ_SetHandler(IRQ_VBLANK, vbl_handler);
+    IRQ_Enable(IRQ_VBLANK);
+
+    DISP_ModeSet(0);
+
+    CON_InitDefault();
+
+    CON_Print("GBT Player LZ77 example");
+
+    // The sound hardware needs to be enabled to write to any other register.
+    SOUND_MasterEnable(1);
+
+    gbt_play(template, 0);
+
+    while (1)
+        SWI_VBlankIntrWait();
+
+    return 0;
+}
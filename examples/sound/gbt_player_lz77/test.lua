@@ -0,0 +1,12 @@
+-- Test that records 2 seconds of audio and compares them with the audio of
+-- the GBT Player example, recorded by its own test script
+
+wav_record_start()
+run_frames_and_pause(120)
+wav_record_end()
+
+-- Let the song reach the jump to the end of the song and finish
+run_frames_and_pause(180)
+exit()
+
+return 0
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz
+
+// Compares two frame hash traces and reports the first frame that is different.
+//
+// A frame hash trace contains one 64-bit hash for each frame rendered during a
+// test run. This makes it possible to check every frame of a run instead of
+// just the frames saved as screenshots. The format is:
+//
+//   Offset | Size  | Description
+//   -------+-------+--------------------------------------------------
+//   0      | 4     | Magic string: "FHSH"
+//   4      | 4     | Format version: 1 (little endian)
+//   8      | 8 * N | Hash of frames 0 to N - 1 (little endian)
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_MAGIC         "FHSH"
+#define TRACE_VERSION       1
+
+// Number of hashes read from each file at a time
+#define CHUNK_HASHES        1024
+
+static uint32_t read_u32_le(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64_le(const unsigned char *p)
+{
+    return (uint64_t)read_u32_le(p) | ((uint64_t)read_u32_le(p + 4) << 32);
+}
+
+// Opens a trace file and checks that the header is valid
+FILE *Open_Trace(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        printf("%s(): Can't open file\n", __func__);
+        return NULL;
+    }
+
+    unsigned char header[8];
+
+    if (fread(header, sizeof(header), 1, f) != 1)
+    {
+        printf("%s(): Can't read header\n", __func__);
+        fclose(f);
+        return NULL;
+    }
+
+    if (memcmp(header, TRACE_MAGIC, 4) != 0)
+    {
+        printf("%s(): Invalid magic string\n", __func__);
+        fclose(f);
+        return NULL;
+    }
+
+    uint32_t version = read_u32_le(&header[4]);
+    if (version != TRACE_VERSION)
+    {
+        printf("%s(): Unsupported version: %" PRIu32 "\n", __func__, version);
+        fclose(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        printf("Usage: %s reference.fhsh trace.fhsh\n"
+               "Return: 0 if the traces match, 1 if they don't.\n",
+               argv[0]);
+
+        return 2;
+    }
+
+    int ret = 1;
+
+    FILE *f1 = NULL;
+    FILE *f2 = NULL;
+
+    f1 = Open_Trace(argv[1]);
+    if (f1 == NULL)
+    {
+        printf("Failed to read %s\n", argv[1]);
+        goto cleanup;
+    }
+
+    f2 = Open_Trace(argv[2]);
+    if (f2 == NULL)
+    {
+        printf("Failed to read %s\n", argv[2]);
+        goto cleanup;
+    }
+
+    static unsigned char buffer1[CHUNK_HASHES * 8];
+    static unsigned char buffer2[CHUNK_HASHES * 8];
+
+    uint64_t frame = 0;
+
+    while (1)
+    {
+        size_t read1 = fread(buffer1, 8, CHUNK_HASHES, f1);
+        size_t read2 = fread(buffer2, 8, CHUNK_HASHES, f2);
+
+        size_t common = (read1 < read2) ? read1 : read2;
+
+        if (memcmp(buffer1, buffer2, common * 8) != 0)
+        {
+            // Only look for the exact frame once we know that there is one
+            for (size_t i = 0; i < common; i++)
+            {
+                uint64_t hash1 = read_u64_le(&buffer1[i * 8]);
+                uint64_t hash2 = read_u64_le(&buffer2[i * 8]);
+
+                if (hash1 != hash2)
+                {
+                    printf("Frame %" PRIu64 ": 0x%016" PRIX64 " != "
+                           "0x%016" PRIX64 "\n", frame + i, hash1, hash2);
+                    goto cleanup;
+                }
+            }
+        }
+
+        frame += common;
+
+        if (read1 != read2)
+        {
+            // One of the runs has more frames than the other one. All the
+            // frames they have in common are the same.
+            printf("Frame %" PRIu64 ": Trace length is different\n", frame);
+            goto cleanup;
+        }
+
+        if (read1 < CHUNK_HASHES)
+            break;
+    }
+
+    if (ferror(f1) || ferror(f2))
+    {
+        printf("Error while reading traces\n");
+        goto cleanup;
+    }
+
+    // Success
+    ret = 0;
+
+cleanup:
+
+    if (f1 != NULL)
+        fclose(f1);
+    if (f2 != NULL)
+        fclose(f2);
+
+    return ret;
+}
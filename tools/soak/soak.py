@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: MIT
+#
+# Copyright (c) 2022 Antonio Niño Díaz
+
+# Soak test runner for the SDL2 builds of the examples.
+#
+# It runs several instances of an example in parallel. Each instance gets a Lua
+# script with a random sequence of key presses generated from a seed, so any
+# failure can be reproduced by running the same seed again. The script of each
+# instance and its output are saved in a folder named after the seed.
+#
+# A run is considered a failure if the program crashes, returns an error code,
+# takes too long, or prints an UBSan/ASan report or an assertion failure. Build
+# the examples with -DENABLE_UBSAN=ON to get sanitizer reports.
+#
+# Example:
+#
+#     python3 soak.py --binary build/examples/input/simple_input/sdl2/simple_input \
+#                     --frames 100000 --instances 16
+#
+#     # Reproduce the failure of seed 7
+#     python3 soak.py --binary ... --frames 100000 --seed 7 --instances 1
+
+import concurrent.futures
+import os
+import random
+import re
+import subprocess
+
+KEYS = [ "A", "B", "SELECT", "START", "RIGHT", "LEFT", "UP", "DOWN", "R", "L" ]
+
+# Maximum number of frames between two changes of the state of the keys
+MAX_FRAMES_PER_STEP = 30
+
+# Patterns of the output of a program that mean that something has gone wrong
+FAILURE_PATTERNS = [
+    re.compile(r"runtime error:"),          # UBSan
+    re.compile(r"ERROR: AddressSanitizer"), # ASan
+    re.compile(r"ERROR: LeakSanitizer"),    # LSan (part of ASan)
+    # UGBA_Assert() and glibc assert():
+    #     "file.c:NN: func: Assertion `expr' failed."
+    re.compile(r":\d+: .*Assertion [`'].*' failed"),
+    # musl assert():
+    #     "Assertion failed: expr (file.c: func: NN)"
+    re.compile(r"^Assertion failed: .* \(.*: \d+\)$", re.MULTILINE),
+]
+
+def generate_script(seed, frames):
+    rng = random.Random(seed)
+
+    lines = [
+        f"-- Soak test script generated by soak.py with seed {seed}",
+        "",
+    ]
+
+    held = set()
+    elapsed = 0
+
+    while elapsed < frames:
+        key = rng.choice(KEYS)
+        if key in held:
+            lines.append(f'keys_release("{key}")')
+            held.remove(key)
+        else:
+            lines.append(f'keys_hold("{key}")')
+            held.add(key)
+
+        step = min(rng.randint(1, MAX_FRAMES_PER_STEP), frames - elapsed)
+        lines.append(f"run_frames_and_pause({step})")
+        elapsed += step
+
+    lines.extend([ "exit()", "", "return 0", "" ])
+
+    return "\n".join(lines)
+
+def run_instance(binary, seed, frames, out_dir, timeout):
+    work_dir = os.path.join(out_dir, f"seed-{seed}")
+    os.makedirs(work_dir, exist_ok=True)
+
+    script_path = os.path.join(work_dir, "soak.lua")
+    with open(script_path, "w") as f:
+        f.write(generate_script(seed, frames))
+
+    # Run without a window or audio device so that many instances can run at
+    # the same time on machines without a display.
+    env = dict(os.environ)
+    env.setdefault("SDL_VIDEODRIVER", "dummy")
+    env.setdefault("SDL_AUDIODRIVER", "dummy")
+    env.setdefault("UBSAN_OPTIONS", "print_stacktrace=1")
+
+    try:
+        result = subprocess.run([binary, "--lua", os.path.abspath(script_path)],
+                                cwd=work_dir, env=env, timeout=timeout,
+                                stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        output = result.stdout.decode("utf-8", errors="replace")
+        returncode = result.returncode
+    except subprocess.TimeoutExpired as e:
+        output = (e.stdout or b"").decode("utf-8", errors="replace")
+        returncode = None
+
+    with open(os.path.join(work_dir, "output.txt"), "w") as f:
+        f.write(output)
+
+    if returncode is None:
+        return (seed, "Timeout")
+    if returncode < 0:
+        return (seed, f"Killed by signal {-returncode}")
+    if returncode != 0:
+        return (seed, f"Exit code {returncode}")
+
+    for pattern in FAILURE_PATTERNS:
+        match = pattern.search(output)
+        if match:
+            line = output[output.rfind("\n", 0, match.start()) + 1:].split("\n")[0]
+            return (seed, f"Output: {line.strip()}")
+
+    return (seed, None)
+
+if __name__ == "__main__":
+
+    import argparse
+    import sys
+
+    parser = argparse.ArgumentParser(description='Run SDL2 examples with random input.')
+    parser.add_argument("--binary", required=True,
+                        help="SDL2 build of the example to run")
+    parser.add_argument("--frames", type=int, default=10000,
+                        help="frames to run in each instance")
+    parser.add_argument("--instances", type=int, default=os.cpu_count(),
+                        help="number of instances to run")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count(),
+                        help="number of instances to run at the same time")
+    parser.add_argument("--seed", type=int, default=0,
+                        help="seed of the first instance (the rest use the following ones)")
+    parser.add_argument("--timeout", type=float, default=None,
+                        help="maximum time in seconds of each instance")
+    parser.add_argument("--output", default="soak",
+                        help="folder to save the scripts and output of each instance")
+
+    args = parser.parse_args()
+
+    binary = os.path.abspath(args.binary)
+    seeds = range(args.seed, args.seed + args.instances)
+
+    failures = 0
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as executor:
+        futures = [ executor.submit(run_instance, binary, seed, args.frames,
+                                    args.output, args.timeout) for seed in seeds ]
+
+        for future in concurrent.futures.as_completed(futures):
+            seed, error = future.result()
+            if error is None:
+                print(f"Seed {seed}: OK")
+            else:
+                print(f"Seed {seed}: FAILED: {error}")
+                failures += 1
+
+    print("")
+    print(f"{args.instances - failures} passed, {failures} failed "
+          f"({args.instances * args.frames} frames)")
+
+    sys.exit(1 if failures > 0 else 0)
@@ -0,0 +1,532 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz
+
+// Compares the samples of two WAV files and reports the first one that is
+// different. Only the format and the samples are compared, so differences in
+// the headers (extra chunks, sizes of the RIFF chunk, etc) are ignored.
+//
+// The files are read in chunks of a fixed size, so the memory used doesn't
+// depend on the length of the files.
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of frames (one sample per channel) read from each file at a time
+#define CHUNK_FRAMES        4096
+
+// Number of frames compared to find the best alignment between files
+#define ALIGN_WINDOW        4096
+
+#define MAX_CHANNELS        2
+
+typedef struct {
+    FILE *f;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t bits_per_sample;
+    uint16_t block_align;   // Size of one frame in bytes
+    long data_offset;       // Start of the samples in the file
+    uint32_t frames;        // Total number of frames in the file
+    uint32_t position;      // Next frame to be read
+} wav_file;
+
+static uint16_t read_u16_le(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32_le(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Opens a WAV file and reads its format. Returns 0 on success.
+int Wav_Open(wav_file *wav, const char *filename)
+{
+    memset(wav, 0, sizeof(wav_file));
+
+    wav->f = fopen(filename, "rb");
+    if (wav->f == NULL)
+    {
+        printf("%s(): Can't open file\n", __func__);
+        return 1;
+    }
+
+    // Get the size of the file to limit the size of the data chunk. This way
+    // files with wrong sizes in the header can still be compared.
+    fseek(wav->f, 0, SEEK_END);
+    long file_size = ftell(wav->f);
+    rewind(wav->f);
+
+    unsigned char header[12];
+    if (fread(header, sizeof(header), 1, wav->f) != 1)
+    {
+        printf("%s(): Can't read RIFF header\n", __func__);
+        goto error;
+    }
+
+    if ((memcmp(&header[0], "RIFF", 4) != 0) ||
+        (memcmp(&header[8], "WAVE", 4) != 0))
+    {
+        printf("%s(): Not a WAV file\n", __func__);
+        goto error;
+    }
+
+    int fmt_found = 0;
+
+    while (1)
+    {
+        unsigned char chunk[8];
+        if (fread(chunk, sizeof(chunk), 1, wav->f) != 1)
+        {
+            printf("%s(): Data chunk not found\n", __func__);
+            goto error;
+        }
+
+        uint32_t size = read_u32_le(&chunk[4]);
+
+        if (memcmp(&chunk[0], "fmt ", 4) == 0)
+        {
+            unsigned char fmt[16];
+            if ((size < sizeof(fmt)) || (fread(fmt, sizeof(fmt), 1, wav->f) != 1))
+            {
+                printf("%s(): Invalid fmt chunk\n", __func__);
+                goto error;
+            }
+
+            uint16_t format = read_u16_le(&fmt[0]);
+            wav->channels = read_u16_le(&fmt[2]);
+            wav->sample_rate = read_u32_le(&fmt[4]);
+            wav->block_align = read_u16_le(&fmt[12]);
+            wav->bits_per_sample = read_u16_le(&fmt[14]);
+
+            // 0xFFFE is WAVE_FORMAT_EXTENSIBLE, used by some programs even for
+            // regular PCM files.
+            if ((format != 1) && (format != 0xFFFE))
+            {
+                printf("%s(): Unsupported format: 0x%04X\n", __func__, format);
+                goto error;
+            }
+
+            if ((wav->bits_per_sample != 8) && (wav->bits_per_sample != 16))
+            {
+                printf("%s(): Unsupported bits per sample: %u\n", __func__,
+                       wav->bits_per_sample);
+                goto error;
+            }
+
+            if ((wav->channels == 0) || (wav->channels > MAX_CHANNELS) ||
+                (wav->block_align != wav->channels * wav->bits_per_sample / 8))
+            {
+                printf("%s(): Unsupported channel layout\n", __func__);
+                goto error;
+            }
+
+            fmt_found = 1;
+
+            // Skip the rest of the chunk
+            size -= sizeof(fmt);
+        }
+        else if (memcmp(&chunk[0], "data", 4) == 0)
+        {
+            if (fmt_found == 0)
+            {
+                printf("%s(): Data chunk found before fmt chunk\n", __func__);
+                goto error;
+            }
+
+            wav->data_offset = ftell(wav->f);
+
+            long available = file_size - wav->data_offset;
+            if (available < 0)
+            {
+                printf("%s(): Data chunk past the end of the file\n", __func__);
+                goto error;
+            }
+
+            // Compare as 64-bit values so that huge sizes (like the 0xFFFFFFFF
+            // used by streamed files) don't wrap around if long is 32-bit.
+            if ((uint64_t)size > (uint64_t)available)
+                size = (uint32_t)available;
+
+            wav->frames = size / wav->block_align;
+
+            return 0;
+        }
+
+        // Chunks are padded to an even size
+        if (fseek(wav->f, size + (size & 1), SEEK_CUR) != 0)
+        {
+            printf("%s(): Can't skip chunk\n", __func__);
+            goto error;
+        }
+    }
+
+error:
+    fclose(wav->f);
+    wav->f = NULL;
+    return 1;
+}
+
+void Wav_Close(wav_file *wav)
+{
+    if (wav->f != NULL)
+        fclose(wav->f);
+}
+
+// Moves the read position to the specified frame
+int Wav_Seek(wav_file *wav, uint32_t frame)
+{
+    if (frame > wav->frames)
+        frame = wav->frames;
+
+    wav->position = frame;
+
+    // Calculate the offset in 64 bits, long may be 32-bit
+    int64_t offset = (int64_t)wav->data_offset +
+                     (int64_t)frame * wav->block_align;
+    if (offset > LONG_MAX)
+        return 1;
+
+    return fseek(wav->f, (long)offset, SEEK_SET);
+}
+
+// Reads up to the specified number of frames and converts them to signed 16-bit
+// samples. Returns the number of frames read.
+size_t Wav_Read(wav_file *wav, int16_t *buffer, size_t frames)
+{
+    static unsigned char raw[CHUNK_FRAMES * MAX_CHANNELS * 2];
+
+    // Don't read any chunk that comes after the data chunk
+    if (frames > wav->frames - wav->position)
+        frames = wav->frames - wav->position;
+
+    size_t total = 0;
+
+    while (total < frames)
+    {
+        size_t count = frames - total;
+        if (count > CHUNK_FRAMES)
+            count = CHUNK_FRAMES;
+
+        size_t read = fread(raw, wav->block_align, count, wav->f);
+
+        size_t samples = read * wav->channels;
+        int16_t *dst = &buffer[total * wav->channels];
+
+        if (wav->bits_per_sample == 8)
+        {
+            for (size_t i = 0; i < samples; i++)
+                dst[i] = (int16_t)((raw[i] - 128) * 256);
+        }
+        else
+        {
+            for (size_t i = 0; i < samples; i++)
+                dst[i] = (int16_t)read_u16_le(&raw[i * 2]);
+        }
+
+        total += read;
+
+        if (read < count)
+            break;
+    }
+
+    wav->position += total;
+
+    return total;
+}
+
+// Returns the index of the first sample that differs by more than the tolerance
+// or the number of samples if all of them match.
+static size_t find_mismatch(const int16_t *a, const int16_t *b, size_t samples,
+                            int32_t tolerance)
+{
+    // The block is checked first with a loop without early exits so that the
+    // compiler can vectorize it. The exact position is only searched for if
+    // the block has any difference.
+    int32_t mismatch = 0;
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        int32_t diff = (int32_t)a[i] - (int32_t)b[i];
+        mismatch |= (diff > tolerance) | (diff < -tolerance);
+    }
+
+    if (mismatch == 0)
+        return samples;
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        int32_t diff = (int32_t)a[i] - (int32_t)b[i];
+        if ((diff > tolerance) || (diff < -tolerance))
+            return i;
+    }
+
+    return samples;
+}
+
+// Returns the first frame of the file with a sample louder than the tolerance,
+// or the number of frames of the file if there is none.
+static uint32_t find_start_of_sound(wav_file *wav, int32_t tolerance)
+{
+    static int16_t buffer[CHUNK_FRAMES * MAX_CHANNELS];
+
+    uint32_t frame = 0;
+
+    Wav_Seek(wav, 0);
+
+    while (frame < wav->frames)
+    {
+        size_t read = Wav_Read(wav, buffer, CHUNK_FRAMES);
+        if (read == 0)
+            break;
+
+        for (size_t i = 0; i < read * wav->channels; i++)
+        {
+            if ((buffer[i] > tolerance) || (buffer[i] < -tolerance))
+                return frame + i / wav->channels;
+        }
+
+        frame += read;
+    }
+
+    return wav->frames;
+}
+
+// Looks for the offset in frames (between -max_offset and max_offset) that makes
+// the test file match the reference best. A positive offset means that the
+// sound starts later in the test file than in the reference.
+static int32_t find_alignment(wav_file *ref, wav_file *test, int32_t max_offset,
+                              int32_t tolerance)
+{
+    static int16_t buffer_ref[ALIGN_WINDOW * MAX_CHANNELS];
+    int16_t *buffer_test;
+
+    // Compare the window that starts where the sound of the reference starts.
+    // If the start of the file was used, any offset would match any silence at
+    // the start of the files.
+    uint32_t start = find_start_of_sound(ref, tolerance);
+    if (start == ref->frames)
+        return 0;
+
+    Wav_Seek(ref, start);
+    size_t window = Wav_Read(ref, buffer_ref, ALIGN_WINDOW);
+
+    // Load the frames of the test file that can be reached with any offset
+    int64_t test_start = (int64_t)start - max_offset;
+    if (test_start < 0)
+        test_start = 0;
+
+    if ((uint64_t)test_start >= test->frames)
+        return 0;
+
+    // Don't allocate space for frames that aren't in the file. The size is
+    // calculated in 64 bits so that it doesn't overflow for big ranges.
+    uint64_t test_size = (uint64_t)window + 2 * (uint64_t)max_offset;
+    if (test_size > test->frames - (uint64_t)test_start)
+        test_size = test->frames - (uint64_t)test_start;
+
+    if (test_size > SIZE_MAX / (MAX_CHANNELS * sizeof(int16_t)))
+        return 0;
+
+    buffer_test = malloc((size_t)test_size * MAX_CHANNELS * sizeof(int16_t));
+    if (buffer_test == NULL)
+        return 0;
+
+    Wav_Seek(test, test_start);
+    size_t test_read = Wav_Read(test, buffer_test, (size_t)test_size);
+
+    int32_t best_offset = 0;
+    uint64_t best_error = UINT64_MAX;
+
+    // Check offsets from the smallest to the biggest so that, if several of them
+    // have the same error, the smallest one is used.
+    for (int64_t i = 0; i <= 2 * (int64_t)max_offset; i++)
+    {
+        int32_t offset = (int32_t)((i & 1) ? -((i + 1) / 2) : (i / 2));
+
+        int64_t first = (int64_t)start + offset - test_start;
+        if ((first < 0) || ((size_t)first + window > test_read))
+            continue;
+
+        const int16_t *a = buffer_ref;
+        const int16_t *b = &buffer_test[first * test->channels];
+
+        uint64_t error = 0;
+        for (size_t j = 0; j < window * ref->channels; j++)
+        {
+            int32_t diff = (int32_t)a[j] - (int32_t)b[j];
+            error += (diff < 0) ? -diff : diff;
+        }
+
+        if (error < best_error)
+        {
+            best_error = error;
+            best_offset = offset;
+        }
+    }
+
+    free(buffer_test);
+
+    return best_offset;
+}
+
+void Print_Usage(const char *name)
+{
+    printf("Usage: %s [options] reference.wav test.wav\n"
+           "\n"
+           "Options:\n"
+           "  --tolerance N  Max difference allowed between samples (default: 0)\n"
+           "  --align N      Look for the best alignment of the files within\n"
+           "                 N frames before comparing them (default: 0)\n"
+           "\n"
+           "Return: 0 if the files match, 1 if they don't.\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    int32_t tolerance = 0;
+    int32_t max_offset = 0;
+
+    const char *path_ref = NULL;
+    const char *path_test = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--tolerance") == 0) && (i + 1 < argc))
+        {
+            tolerance = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--align") == 0) && (i + 1 < argc))
+        {
+            max_offset = atoi(argv[++i]);
+        }
+        else if (path_ref == NULL)
+        {
+            path_ref = argv[i];
+        }
+        else if (path_test == NULL)
+        {
+            path_test = argv[i];
+        }
+        else
+        {
+            path_ref = NULL;
+            break;
+        }
+    }
+
+    if ((path_ref == NULL) || (path_test == NULL) ||
+        (tolerance < 0) || (max_offset < 0))
+    {
+        Print_Usage(argv[0]);
+        return 2;
+    }
+
+    int ret = 1;
+
+    wav_file ref = { 0 };
+    wav_file test = { 0 };
+
+    if (Wav_Open(&ref, path_ref) != 0)
+    {
+        printf("Failed to read %s\n", path_ref);
+        goto cleanup;
+    }
+
+    if (Wav_Open(&test, path_test) != 0)
+    {
+        printf("Failed to read %s\n", path_test);
+        goto cleanup;
+    }
+
+    if ((ref.channels != test.channels) ||
+        (ref.sample_rate != test.sample_rate))
+    {
+        // The files have different formats, which means that the user probably
+        // made a mistake when passing the paths.
+        printf("Formats are different\n");
+        goto cleanup;
+    }
+
+    // An offset bigger than the length of both files would leave nothing to
+    // compare, so it's most likely a mistake.
+    uint32_t max_frames = (ref.frames > test.frames) ? ref.frames : test.frames;
+    if ((uint32_t)max_offset > max_frames)
+    {
+        printf("Alignment range is longer than the files\n");
+        goto cleanup;
+    }
+
+    int32_t offset = 0;
+    if (max_offset > 0)
+    {
+        offset = find_alignment(&ref, &test, max_offset, tolerance);
+        printf("Alignment offset: %" PRId32 " frames\n", offset);
+    }
+
+    uint32_t ref_frame = (offset < 0) ? -offset : 0;
+    uint32_t test_frame = (offset > 0) ? offset : 0;
+
+    Wav_Seek(&ref, ref_frame);
+    Wav_Seek(&test, test_frame);
+
+    static int16_t buffer_ref[CHUNK_FRAMES * MAX_CHANNELS];
+    static int16_t buffer_test[CHUNK_FRAMES * MAX_CHANNELS];
+
+    while (1)
+    {
+        size_t read_ref = Wav_Read(&ref, buffer_ref, CHUNK_FRAMES);
+        size_t read_test = Wav_Read(&test, buffer_test, CHUNK_FRAMES);
+
+        size_t common = (read_ref < read_test) ? read_ref : read_test;
+        size_t samples = common * ref.channels;
+
+        size_t i = find_mismatch(buffer_ref, buffer_test, samples, tolerance);
+        if (i != samples)
+        {
+            uint32_t frame = ref_frame + i / ref.channels;
+            printf("Frame %" PRIu32 " (%.3f s), channel %zu: %d != %d\n",
+                   frame, (double)frame / ref.sample_rate, i % ref.channels,
+                   buffer_ref[i], buffer_test[i]);
+            goto cleanup;
+        }
+
+        ref_frame += common;
+        test_frame += common;
+
+        if (common < CHUNK_FRAMES)
+            break;
+    }
+
+    // If the files have been aligned, the end of one of them may have a few
+    // more frames than the other one. That's allowed as long as the difference
+    // isn't bigger than the alignment search range.
+    uint32_t left_ref = ref.frames - ref_frame;
+    uint32_t left_test = test.frames - test_frame;
+    uint32_t left = (left_ref > left_test) ? left_ref : left_test;
+
+    if (left > (uint32_t)max_offset)
+    {
+        printf("Frame %" PRIu32 " (%.3f s): Lengths are different\n",
+               ref_frame, (double)ref_frame / ref.sample_rate);
+        goto cleanup;
+    }
+
+    // Success
+    ret = 0;
+
+cleanup:
+
+    Wav_Close(&ref);
+    Wav_Close(&test);
+
+    return ret;
+}
@@ -50,9 +50,24 @@ function(define_unittest)
     # Define CMake test
     # -----------------
 
-    add_test(NAME ${EXECUTABLE_NAME}_unittest
-        COMMAND ${EXECUTABLE_NAME}
-        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
-    )
+    if(UGBA_TEST_CACHE)
+        unittest_cache_args(CACHE_ARGS
+            $<TARGET_FILE:${EXECUTABLE_NAME}>
+            $<TARGET_FILE:libugba>
+        )
+
+        add_test(NAME ${EXECUTABLE_NAME}_unittest
+            COMMAND ${CMAKE_COMMAND}
+                        -DCMD1=$<TARGET_FILE:${EXECUTABLE_NAME}>
+                        ${CACHE_ARGS}
+                        -P ${CMAKE_SOURCE_DIR}/cmake/runcommands.cmake
+            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        )
+    else()
+        add_test(NAME ${EXECUTABLE_NAME}_unittest
+            COMMAND ${EXECUTABLE_NAME}
+            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        )
+    endif()
 
 endfunction()